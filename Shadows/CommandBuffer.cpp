@@ -0,0 +1,198 @@
+#include "CommandBuffer.h"
+
+#include <glad/glad.h>
+
+static GLenum toGLTarget(TextureTarget _target)
+{
+	switch (_target)
+	{
+	case TextureTarget::CubeMap: return GL_TEXTURE_CUBE_MAP;
+	case TextureTarget::Buffer: return GL_TEXTURE_BUFFER;
+	default: return GL_TEXTURE_2D;
+	}
+}
+
+static GLenum toGLIndexType(IndexType _indexType)
+{
+	return _indexType == IndexType::UInt16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+static GLenum occlusionQueryTarget()
+{
+	return GLAD_GL_VERSION_4_3 ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+}
+
+void CommandBuffer::clear()
+{
+	commands.clear();
+	payload.clear();
+	ranges.clear();
+	indirectDraws.clear();
+}
+
+void CommandBuffer::bindVertexArray(unsigned int _vertexArray)
+{
+	commands.push_back({ CommandType::BindVertexArray, { _vertexArray, 0, 0, 0 } });
+}
+
+void CommandBuffer::bindTexture(unsigned int _unit, TextureTarget _target, unsigned int _texture)
+{
+	commands.push_back({ CommandType::BindTexture, { _unit, (unsigned int)_target, _texture, 0 } });
+}
+
+void CommandBuffer::setUniform(int _location, int _value)
+{
+	if (_location < 0)
+		return;
+	commands.push_back({ CommandType::SetUniformInt, { (unsigned int)_location, (unsigned int)_value, 0, 0 } });
+}
+
+void CommandBuffer::setUniform(int _location, const glm::vec3 &_value)
+{
+	if (_location < 0)
+		return;
+	commands.push_back({ CommandType::SetUniformVec3, { (unsigned int)_location, (unsigned int)payload.size(), 0, 0 } });
+	payload.insert(payload.end(), &_value[0], &_value[0] + 3);
+}
+
+void CommandBuffer::setUniform(int _location, const glm::mat4 &_value)
+{
+	if (_location < 0)
+		return;
+	commands.push_back({ CommandType::SetUniformMat4, { (unsigned int)_location, (unsigned int)payload.size(), 0, 0 } });
+	payload.insert(payload.end(), &_value[0][0], &_value[0][0] + 16);
+}
+
+void CommandBuffer::drawElements(unsigned int _count, IndexType _indexType, size_t _byteOffset)
+{
+	commands.push_back({ CommandType::DrawElements, { _count, (unsigned int)_indexType, (unsigned int)_byteOffset, 0 } });
+}
+
+void CommandBuffer::multiDrawElements(const unsigned int *_ranges, unsigned int _rangeCount, IndexType _indexType)
+{
+	if (_rangeCount == 0)
+		return;
+	if (_rangeCount == 1)
+	{
+		drawElements(_ranges[0], _indexType, _ranges[1]);
+		return;
+	}
+	commands.push_back({ CommandType::MultiDrawElements, { _rangeCount, (unsigned int)_indexType, (unsigned int)ranges.size(), 0 } });
+	ranges.insert(ranges.end(), _ranges, _ranges + _rangeCount * 2);
+}
+
+void CommandBuffer::multiDrawElementsIndirect(const IndirectDraw *_draws, unsigned int _drawCount, IndexType _indexType)
+{
+	if (_drawCount == 0)
+		return;
+	unsigned int first = (unsigned int)indirectDraws.size();
+	commands.push_back({ CommandType::MultiDrawElementsIndirect, { first, _drawCount, (unsigned int)_indexType, 0 } });
+	for (unsigned int i = 0; i < _drawCount; i++)
+	{
+		indirectDraws.push_back(_draws[i]);
+		indirectDraws.back().group = first;
+	}
+}
+
+void CommandBuffer::drawArrays(unsigned int _first, unsigned int _count)
+{
+	commands.push_back({ CommandType::DrawArrays, { _first, _count, 0, 0 } });
+}
+
+void CommandBuffer::beginQuery(unsigned int _query)
+{
+	commands.push_back({ CommandType::BeginQuery, { _query, 0, 0, 0 } });
+}
+
+void CommandBuffer::endQuery()
+{
+	commands.push_back({ CommandType::EndQuery, { 0, 0, 0, 0 } });
+}
+
+void CommandBuffer::beginConditionalRender(unsigned int _query)
+{
+	commands.push_back({ CommandType::BeginConditionalRender, { _query, 0, 0, 0 } });
+}
+
+void CommandBuffer::endConditionalRender()
+{
+	commands.push_back({ CommandType::EndConditionalRender, { 0, 0, 0, 0 } });
+}
+
+void CommandBuffer::replay(ReplayState &_state) const
+{
+	for (const Command &command : commands)
+	{
+		const unsigned int *args = command.args;
+		switch (command.type)
+		{
+		case CommandType::BindVertexArray:
+			if (_state.vertexArray != args[0])
+			{
+				glBindVertexArray(args[0]);
+				_state.vertexArray = args[0];
+			}
+			break;
+		case CommandType::BindTexture:
+			// only 2D bindings are tracked, other targets share the unit and always rebind
+			if (args[0] < ReplayState::maxTextureUnits && (TextureTarget)args[1] == TextureTarget::Texture2D && _state.textures[args[0]] == args[2])
+				break;
+			if (_state.activeUnit != args[0])
+			{
+				glActiveTexture(GL_TEXTURE0 + args[0]);
+				_state.activeUnit = args[0];
+			}
+			glBindTexture(toGLTarget((TextureTarget)args[1]), args[2]);
+			if (args[0] < ReplayState::maxTextureUnits && (TextureTarget)args[1] == TextureTarget::Texture2D)
+				_state.textures[args[0]] = args[2];
+			break;
+		case CommandType::SetUniformInt:
+			glUniform1i((GLint)args[0], (GLint)args[1]);
+			break;
+		case CommandType::SetUniformVec3:
+			glUniform3fv((GLint)args[0], 1, &payload[args[1]]);
+			break;
+		case CommandType::SetUniformMat4:
+			glUniformMatrix4fv((GLint)args[0], 1, GL_FALSE, &payload[args[1]]);
+			break;
+		case CommandType::DrawElements:
+			if (_state.indirectOnly)
+				break;
+			glDrawElements(GL_TRIANGLES, args[0], toGLIndexType((IndexType)args[1]), (void*)(size_t)args[2]);
+			break;
+		case CommandType::MultiDrawElements:
+			if (_state.indirectOnly)
+				break;
+			_state.counts.resize(args[0]);
+			_state.offsets.resize(args[0]);
+			for (unsigned int i = 0; i < args[0]; i++)
+			{
+				_state.counts[i] = (int)ranges[args[2] + i * 2];
+				_state.offsets[i] = (const void*)(size_t)ranges[args[2] + i * 2 + 1];
+			}
+			glMultiDrawElements(GL_TRIANGLES, &_state.counts[0], toGLIndexType((IndexType)args[1]), &_state.offsets[0], (GLsizei)args[0]);
+			break;
+		case CommandType::MultiDrawElementsIndirect:
+			glMultiDrawElementsIndirect(GL_TRIANGLES, toGLIndexType((IndexType)args[2]), (const void*)((size_t)(_state.indirectBase + args[0]) * indirectCommandSize),
+				(GLsizei)args[1], 0);
+			break;
+		case CommandType::DrawArrays:
+			if (_state.indirectOnly)
+				break;
+			glDrawArrays(GL_TRIANGLES, args[0], args[1]);
+			break;
+		case CommandType::BeginQuery:
+			glBeginQuery(occlusionQueryTarget(), args[0]);
+			break;
+		case CommandType::EndQuery:
+			glEndQuery(occlusionQueryTarget());
+			break;
+		case CommandType::BeginConditionalRender:
+			glBeginConditionalRender(args[0], GL_QUERY_NO_WAIT);
+			break;
+		case CommandType::EndConditionalRender:
+			glEndConditionalRender();
+			break;
+		}
+	}
+}
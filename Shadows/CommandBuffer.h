@@ -0,0 +1,102 @@
+#ifndef _COMMANDBUFFER_H_
+#define _COMMANDBUFFER_H_
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Backend independent description of the work a pass submits. Buffers can be filled on any thread,
+// only replay() touches the graphics API and has to run on the GL thread.
+enum class CommandType : unsigned char {
+	BindVertexArray,
+	BindTexture,
+	SetUniformInt,
+	SetUniformVec3,
+	SetUniformMat4,
+	DrawElements,
+	MultiDrawElements,
+	MultiDrawElementsIndirect,
+	DrawArrays,
+	BeginQuery,
+	EndQuery,
+	BeginConditionalRender,
+	EndConditionalRender
+};
+
+enum class TextureTarget : unsigned int { Texture2D, CubeMap, Buffer };
+enum class IndexType : unsigned int { UInt16, UInt32 };
+
+// A draw whose instance count is left to the GPU occlusion culler, together with the world space bounding sphere
+// it's tested with. Matches the culling shader's std430 layout.
+struct IndirectDraw {
+	glm::vec4 sphere;			// centre and radius
+	unsigned int count;
+	unsigned int firstIndex;
+	unsigned int group;			// first draw of the multi draw it belongs to, visible draws are packed from there
+	unsigned int padding;
+};
+
+// size of a DrawElementsIndirectCommand (count, instanceCount, firstIndex, baseVertex, baseInstance)
+const unsigned int indirectCommandSize = 5 * sizeof(unsigned int);
+
+struct Command {
+	CommandType type;
+	unsigned int args[4];
+};
+
+// redundant state filtering shared by all buffers replayed in one go
+struct ReplayState {
+	static const unsigned int maxTextureUnits = 16;
+
+	unsigned int vertexArray = 0;
+	unsigned int activeUnit = ~0u;
+	unsigned int textures[maxTextureUnits] = {};
+
+	// where this buffer's indirect draws start in the bound GL_DRAW_INDIRECT_BUFFER
+	unsigned int indirectBase = 0;
+	// replays only the indirect draws, for a second pass over the same commands with other indirect commands
+	bool indirectOnly = false;
+
+	// scratch arrays for glMultiDrawElements, kept around so replay doesn't allocate
+	std::vector<int> counts;
+	std::vector<const void*> offsets;
+};
+
+class CommandBuffer {
+public:
+	void clear();
+	bool empty() const { return commands.empty(); }
+	size_t size() const { return commands.size(); }
+
+	void bindVertexArray(unsigned int _vertexArray);
+	void bindTexture(unsigned int _unit, TextureTarget _target, unsigned int _texture);
+	void setUniform(int _location, int _value);
+	void setUniform(int _location, const glm::vec3 &_value);
+	void setUniform(int _location, const glm::mat4 &_value);
+	void drawElements(unsigned int _count, IndexType _indexType, size_t _byteOffset);
+	// one draw over several index ranges of the bound element buffer, _ranges holds (count, byte offset) pairs
+	void multiDrawElements(const unsigned int *_ranges, unsigned int _rangeCount, IndexType _indexType);
+	// one draw per IndirectDraw, drawn from the commands the occlusion culler wrote for them
+	void multiDrawElementsIndirect(const IndirectDraw *_draws, unsigned int _drawCount, IndexType _indexType);
+	void drawArrays(unsigned int _first, unsigned int _count);
+	// occlusion query around the draws in between, any samples passed (conservatively where GL 4.3 allows)
+	void beginQuery(unsigned int _query);
+	void endQuery();
+	// the draws in between are skipped by the GPU when _query found nothing visible, no waiting on the result
+	void beginConditionalRender(unsigned int _query);
+	void endConditionalRender();
+
+	// draws recorded with multiDrawElementsIndirect, groups relative to this buffer
+	const std::vector<IndirectDraw> &getIndirectDraws() const { return indirectDraws; }
+
+	// executes the recorded commands, GL thread only
+	void replay(ReplayState &_state) const;
+
+private:
+	std::vector<Command> commands;
+	std::vector<float> payload;
+	std::vector<unsigned int> ranges;
+	std::vector<IndirectDraw> indirectDraws;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "CommandRecorder.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+
+CommandRecorder::~CommandRecorder()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+void CommandRecorder::configure(unsigned int _workerCount)
+{
+	if (_workerCount == 0)
+		_workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+	for (unsigned int i = 0; i < _workerCount; i++)
+		workers.push_back(std::thread(&CommandRecorder::workerLoop, this));
+}
+
+void CommandRecorder::record(unsigned int _itemCount, const std::function<void(unsigned int, CommandBuffer&)> &_recordItem)
+{
+	for (CommandBuffer &buffer : buffers)
+		buffer.clear();
+	indirectBases.clear();
+	dispatch(_itemCount, _recordItem);
+}
+
+void CommandRecorder::run(unsigned int _itemCount, const std::function<void(unsigned int)> &_runItem)
+{
+	std::function<void(unsigned int, CommandBuffer&)> job = [&](unsigned int _item, CommandBuffer &) { _runItem(_item); };
+	dispatch(_itemCount, job);
+}
+
+void CommandRecorder::dispatch(unsigned int _itemCount, const std::function<void(unsigned int, CommandBuffer&)> &_job)
+{
+	// every slice gets a buffer, added ones start out empty so replay() skips over them
+	unsigned int slices = std::max(1u, std::min(_itemCount, (unsigned int)workers.size() + 1));
+	if (buffers.size() < slices)
+		buffers.resize(slices);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &_job;
+		itemCount = _itemCount;
+		sliceCount = slices;
+		nextSlice = 0;
+		pendingSlices = slices;
+		generation++;
+	}
+	// a single slice isn't worth waking anyone up for
+	if (slices > 1)
+		workAvailable.notify_all();
+
+	runSlices();
+
+	// wait for the last slice and for every worker to leave the job before it goes out of scope
+	std::unique_lock<std::mutex> lock(mutex);
+	workDone.wait(lock, [this] { return pendingSlices == 0 && activeWorkers == 0; });
+	job = nullptr;
+}
+
+void CommandRecorder::replay(bool _indirectOnly)
+{
+	ReplayState state;
+	state.indirectOnly = _indirectOnly;
+	for (unsigned int i = 0; i < buffers.size(); i++)
+	{
+		state.indirectBase = i < indirectBases.size() ? indirectBases[i] : 0;
+		buffers[i].replay(state);
+	}
+
+	// always good practice to set everything back to defaults once done
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void CommandRecorder::gatherIndirectDraws(std::vector<IndirectDraw> &_draws)
+{
+	indirectBases.resize(buffers.size());
+	for (unsigned int i = 0; i < buffers.size(); i++)
+	{
+		unsigned int base = (unsigned int)_draws.size();
+		indirectBases[i] = base;
+		for (const IndirectDraw &draw : buffers[i].getIndirectDraws())
+		{
+			_draws.push_back(draw);
+			_draws.back().group += base;
+		}
+	}
+}
+
+size_t CommandRecorder::getCommandCount()
+{
+	size_t count = 0;
+	for (const CommandBuffer &buffer : buffers)
+		count += buffer.size();
+	return count;
+}
+
+void CommandRecorder::workerLoop()
+{
+	unsigned int seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workAvailable.wait(lock, [&] { return stopping || (generation != seenGeneration && job != nullptr); });
+			if (stopping)
+				return;
+			seenGeneration = generation;
+			activeWorkers++;
+		}
+
+		runSlices();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		workDone.notify_all();
+	}
+}
+
+void CommandRecorder::runSlices()
+{
+	while (true)
+	{
+		unsigned int slice = nextSlice++;
+		if (slice >= sliceCount)
+			return;
+
+		unsigned int first = slice * itemCount / sliceCount;
+		unsigned int last = (slice + 1) * itemCount / sliceCount;
+		for (unsigned int i = first; i < last; i++)
+			(*job)(i, buffers[slice]);
+
+		if (--pendingSlices == 0)
+		{
+			// take the lock so the notification can't slip in between the waiter's check and its sleep
+			std::lock_guard<std::mutex> lock(mutex);
+			workDone.notify_all();
+		}
+	}
+}
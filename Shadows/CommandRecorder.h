@@ -0,0 +1,60 @@
+#ifndef _COMMANDRECORDER_H_
+#define _COMMANDRECORDER_H_
+
+#include "CommandBuffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Records a pass in parallel: the items of the scene are split into contiguous slices, each slice is
+// recorded into its own CommandBuffer by a worker thread (the calling thread helps out), and the
+// buffers are then replayed in slice order on the GL thread.
+class CommandRecorder {
+public:
+	~CommandRecorder();
+
+	// starts the worker threads, 0 picks one less than the number of hardware threads
+	void configure(unsigned int _workerCount = 0);
+
+	// calls _recordItem(item, buffer) for every item in [0, _itemCount) and blocks until all slices are done
+	void record(unsigned int _itemCount, const std::function<void(unsigned int, CommandBuffer&)> &_recordItem);
+	// the same slicing for work that records nothing, the buffers of the last record() are left for replay()
+	void run(unsigned int _itemCount, const std::function<void(unsigned int)> &_runItem);
+	// replays the buffers of the last record() call in order, GL thread only. _indirectOnly skips everything but
+	// the indirect draws.
+	void replay(bool _indirectOnly = false);
+	// appends the indirect draws of every buffer in replay order and remembers where each buffer's draws start
+	void gatherIndirectDraws(std::vector<IndirectDraw> &_draws);
+
+	unsigned int getWorkerCount() { return (unsigned int)workers.size(); }
+	size_t getCommandCount();
+
+private:
+	std::vector<std::thread> workers;
+	std::vector<CommandBuffer> buffers;
+	std::vector<unsigned int> indirectBases;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workDone;
+	bool stopping = false;
+	unsigned int generation = 0;
+	unsigned int activeWorkers = 0;
+
+	// current job, only written while no worker is running it
+	const std::function<void(unsigned int, CommandBuffer&)> *job = nullptr;
+	unsigned int itemCount = 0;
+	unsigned int sliceCount = 0;
+	std::atomic<unsigned int> nextSlice{ 0 };
+	std::atomic<unsigned int> pendingSlices{ 0 };
+
+	void dispatch(unsigned int _itemCount, const std::function<void(unsigned int, CommandBuffer&)> &_job);
+	void workerLoop();
+	void runSlices();
+};
+
+#endif
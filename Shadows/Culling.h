@@ -0,0 +1,256 @@
+#ifndef _CULLING_H_
+#define _CULLING_H_
+
+#include <glm/glm.hpp>
+
+#include <xmmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+
+// View frustum as 6 normalised planes (left, right, bottom, top, near, far), pointing inwards.
+// Built from a view-projection matrix, or from projection * view * model to get the planes in model space.
+class Frustum {
+public:
+	glm::vec4 planes[6];
+
+	Frustum() {}
+
+	explicit Frustum(const glm::mat4 &_matrix)
+	{
+		// Gribb/Hartmann: the planes are sums and differences of the matrix rows
+		glm::vec4 rowX(_matrix[0][0], _matrix[1][0], _matrix[2][0], _matrix[3][0]);
+		glm::vec4 rowY(_matrix[0][1], _matrix[1][1], _matrix[2][1], _matrix[3][1]);
+		glm::vec4 rowZ(_matrix[0][2], _matrix[1][2], _matrix[2][2], _matrix[3][2]);
+		glm::vec4 rowW(_matrix[0][3], _matrix[1][3], _matrix[2][3], _matrix[3][3]);
+
+		planes[0] = rowW + rowX;
+		planes[1] = rowW - rowX;
+		planes[2] = rowW + rowY;
+		planes[3] = rowW - rowY;
+		planes[4] = rowW + rowZ;
+		planes[5] = rowW - rowZ;
+
+		for (int i = 0; i < 6; i++)
+			planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+
+	bool intersectsSphere(glm::vec3 _center, float _radius) const
+	{
+		for (int i = 0; i < 6; i++)
+			if (glm::dot(glm::vec3(planes[i]), _center) + planes[i].w < -_radius)
+				return false;
+		return true;
+	}
+};
+
+// box of a box moved by an affine matrix (Arvo): the centre is transformed, the extents go through the
+// absolute value of the matrix
+inline void transformBounds(const glm::mat4 &_model, glm::vec3 _boundsMin, glm::vec3 _boundsMax, glm::vec3 &_center, glm::vec3 &_extents)
+{
+	glm::vec3 halfSize = (_boundsMax - _boundsMin) * 0.5f;
+	_center = glm::vec3(_model * glm::vec4((_boundsMin + _boundsMax) * 0.5f, 1.0f));
+	_extents = glm::abs(glm::vec3(_model[0])) * halfSize.x + glm::abs(glm::vec3(_model[1])) * halfSize.y + glm::abs(glm::vec3(_model[2])) * halfSize.z;
+}
+
+// The frustum planes transposed into SSE registers so four planes are tested per instruction. The six planes
+// are padded to eight by repeating the last one.
+class SimdFrustum {
+public:
+	SimdFrustum() {}
+
+	explicit SimdFrustum(const Frustum &_frustum)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			const glm::vec4 &p0 = _frustum.planes[i * 4], &p1 = _frustum.planes[i * 4 + 1];
+			const glm::vec4 &p2 = _frustum.planes[std::min(i * 4 + 2, 5)], &p3 = _frustum.planes[std::min(i * 4 + 3, 5)];
+			x[i] = _mm_setr_ps(p0.x, p1.x, p2.x, p3.x);
+			y[i] = _mm_setr_ps(p0.y, p1.y, p2.y, p3.y);
+			z[i] = _mm_setr_ps(p0.z, p1.z, p2.z, p3.z);
+			w[i] = _mm_setr_ps(p0.w, p1.w, p2.w, p3.w);
+		}
+	}
+
+	// axis aligned box given as centre and half extents
+	bool intersectsBox(glm::vec3 _center, glm::vec3 _extents) const
+	{
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		__m128 cx = _mm_set1_ps(_center.x), cy = _mm_set1_ps(_center.y), cz = _mm_set1_ps(_center.z);
+		__m128 ex = _mm_set1_ps(_extents.x), ey = _mm_set1_ps(_extents.y), ez = _mm_set1_ps(_extents.z);
+		for (int i = 0; i < 2; i++)
+		{
+			// distance of the centre plus the box's projected radius onto the plane normal
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[i], cx), _mm_mul_ps(y[i], cy)), _mm_add_ps(_mm_mul_ps(z[i], cz), w[i]));
+			__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, x[i]), ex), _mm_mul_ps(_mm_andnot_ps(signMask, y[i]), ey)),
+				_mm_mul_ps(_mm_andnot_ps(signMask, z[i]), ez));
+			if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps())) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	bool intersectsSphere(glm::vec3 _center, float _radius) const
+	{
+		__m128 cx = _mm_set1_ps(_center.x), cy = _mm_set1_ps(_center.y), cz = _mm_set1_ps(_center.z);
+		__m128 radius = _mm_set1_ps(-_radius);
+		for (int i = 0; i < 2; i++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[i], cx), _mm_mul_ps(y[i], cy)), _mm_add_ps(_mm_mul_ps(z[i], cz), w[i]));
+			if (_mm_movemask_ps(_mm_cmplt_ps(distance, radius)) != 0)
+				return false;
+		}
+		return true;
+	}
+
+private:
+	__m128 x[2], y[2], z[2], w[2];
+};
+
+// What a pass culls against. Camera passes use the frustum, shadow passes the light's range.
+struct CullView {
+	glm::vec3 position = glm::vec3(0.0f);	// eye or light position, world space
+	bool useFrustum = false;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	float range = 0.0f;						// radius around position that can be seen, 0 = unlimited
+	// LOD selection: pixels a unit long object covers at distance 1, 0 always draws full detail
+	float pixelScale = 0.0f;
+	float lodPixelError = 1.0f;				// how many pixels an LOD may be off by
+	// contribution culling: meshes whose bounding sphere spans fewer pixels than this are dropped, 0 keeps them all
+	float minPixelSize = 0.0f;
+	// shadow views of a cube map: the six face frusta, draws only go to the faces they touch
+	const SimdFrustum *faceFrusta = nullptr;
+	// meshlets are recorded as indirect draws for the GPU occlusion culler instead of merged ranges
+	bool gpuOcclusion = false;
+};
+
+// whether a world space sphere is big enough on screen to be worth drawing in _view. _scale is the object's
+// own override, it multiplies the view's threshold and 0 always draws
+inline bool contributes(const CullView &_view, glm::vec3 _center, float _radius, float _scale = 1.0f)
+{
+	if (_view.minPixelSize <= 0.0f || _view.pixelScale <= 0.0f || _scale <= 0.0f)
+		return true;
+	// same nearest point distance the LOD selection sizes objects with
+	float distance = glm::length(_center - _view.position) - _radius;
+	if (distance <= 0.0f)
+		return true;
+	return 2.0f * _radius * _view.pixelScale / distance >= _view.minPixelSize * _scale;
+}
+
+// all six cube faces
+const unsigned int allCubeFaces = 0x3F;
+
+// A CullView brought into an object's local space, worked out once per object and shared by its meshes
+struct LocalCullView {
+	Frustum frustum;			// planes in object space
+	SimdFrustum worldFrustum;
+	bool useFrustum;
+	glm::vec3 eye;				// view position in object space, for the normal cones
+	glm::mat4 model;
+	float maxScale;				// how much the model matrix can stretch a radius
+	glm::vec3 position;
+	float range;
+	float lodError;				// object space error the object's LODs may have in this view
+	bool boundsTested = false;	// the meshes already passed a BVH query, only their meshlets are left to cull
+	const SimdFrustum *faceFrusta;
+	bool gpuOcclusion;
+
+	// _boundsCenter/_boundsRadius is the object's bounding sphere in object space, it sizes the object on screen
+	LocalCullView(const CullView &_view, const glm::mat4 &_model, glm::vec3 _boundsCenter, float _boundsRadius)
+		: useFrustum(_view.useFrustum), model(_model), position(_view.position), range(_view.range), lodError(0.0f),
+		faceFrusta(_view.faceFrusta), gpuOcclusion(_view.gpuOcclusion)
+	{
+		if (useFrustum)
+		{
+			frustum = Frustum(_view.viewProjection * _model);
+			worldFrustum = SimdFrustum(Frustum(_view.viewProjection));
+		}
+		eye = glm::vec3(glm::inverse(_model) * glm::vec4(_view.position, 1.0f));
+		maxScale = std::sqrt(std::max(glm::dot(_model[0], _model[0]), std::max(glm::dot(_model[1], _model[1]), glm::dot(_model[2], _model[2]))));
+
+		// projected radius in pixels from the distance to the nearest point of the sphere, the allowed error is the
+		// pixel error as a fraction of that
+		if (_view.pixelScale > 0.0f && _boundsRadius > 0.0f)
+		{
+			float worldRadius = _boundsRadius * maxScale;
+			float distance = glm::length(glm::vec3(_model * glm::vec4(_boundsCenter, 1.0f)) - _view.position) - worldRadius;
+			if (distance > 0.0f)
+			{
+				float screenRadius = worldRadius * _view.pixelScale / distance;
+				lodError = _view.lodPixelError / screenRadius * _boundsRadius;
+			}
+		}
+	}
+
+	// box and sphere in object space, moved into world space with the model matrix and tested against the frustum
+	// or the range
+	bool boundsVisible(glm::vec3 _boxMin, glm::vec3 _boxMax, glm::vec3 _sphereCenter, float _sphereRadius) const
+	{
+		if (useFrustum)
+		{
+			glm::vec3 center, extents;
+			transformBounds(model, _boxMin, _boxMax, center, extents);
+			if (!worldFrustum.intersectsBox(center, extents))
+				return false;
+		}
+		if (range > 0.0f)
+		{
+			glm::vec3 center = glm::vec3(model * glm::vec4(_sphereCenter, 1.0f));
+			float reach = range + _sphereRadius * maxScale;
+			if (glm::dot(center - position, center - position) > reach * reach)
+				return false;
+		}
+		return true;
+	}
+
+	// cube faces an object space box touches, all of them when the view isn't a cube map
+	unsigned int boxFaceMask(glm::vec3 _boxMin, glm::vec3 _boxMax) const
+	{
+		if (!faceFrusta)
+			return allCubeFaces;
+		glm::vec3 center, extents;
+		transformBounds(model, _boxMin, _boxMax, center, extents);
+		unsigned int mask = 0;
+		for (unsigned int i = 0; i < 6; i++)
+			if (faceFrusta[i].intersectsBox(center, extents))
+				mask |= 1u << i;
+		return mask;
+	}
+
+	unsigned int sphereFaceMask(glm::vec3 _center, float _radius) const
+	{
+		if (!faceFrusta)
+			return allCubeFaces;
+		glm::vec3 center = glm::vec3(model * glm::vec4(_center, 1.0f));
+		float radius = _radius * maxScale;
+		unsigned int mask = 0;
+		for (unsigned int i = 0; i < 6; i++)
+			if (faceFrusta[i].intersectsSphere(center, radius))
+				mask |= 1u << i;
+		return mask;
+	}
+
+	// bounding sphere in object space against the frustum or the range
+	bool sphereVisible(glm::vec3 _center, float _radius) const
+	{
+		if (useFrustum && !frustum.intersectsSphere(_center, _radius))
+			return false;
+		if (range > 0.0f)
+		{
+			glm::vec3 worldCenter = glm::vec3(model * glm::vec4(_center, 1.0f));
+			float reach = range + _radius * maxScale;
+			if (glm::dot(worldCenter - position, worldCenter - position) > reach * reach)
+				return false;
+		}
+		return true;
+	}
+
+	// true when every triangle under the normal cone faces away from the eye (meshoptimizer's cone test)
+	bool coneBackfacing(glm::vec3 _center, float _radius, glm::vec3 _coneAxis, float _coneCutoff) const
+	{
+		glm::vec3 toCenter = _center - eye;
+		return glm::dot(toCenter, _coneAxis) >= _coneCutoff * glm::length(toCenter) + _radius;
+	}
+};
+
+#endif
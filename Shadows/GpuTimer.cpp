@@ -0,0 +1,28 @@
+#include "GpuTimer.h"
+
+void GpuTimer::begin()
+{
+	if (!created)
+	{
+		glGenQueries(ringSize, startQueries);
+		glGenQueries(ringSize, endQueries);
+		created = true;
+	}
+
+	// the queries about to be reused were issued ringSize frames ago, long done on the GPU
+	if (used[next])
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(startQueries[next], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(endQueries[next], GL_QUERY_RESULT, &end);
+		profiler.add(counter, (unsigned int)((end - start) / 1000));
+	}
+	glQueryCounter(startQueries[next], GL_TIMESTAMP);
+}
+
+void GpuTimer::end()
+{
+	glQueryCounter(endQueries[next], GL_TIMESTAMP);
+	used[next] = true;
+	next = (next + 1) % ringSize;
+}
@@ -0,0 +1,30 @@
+#ifndef _GPUTIMER_H_
+#define _GPUTIMER_H_
+
+#include <glad/glad.h>
+
+#include "Profiler.h"
+
+// Times a stretch of GL commands with a pair of GL_TIMESTAMP queries, so timers can run inside each other. The
+// queries go round a small ring and a result is only read back when its queries come up again a few frames
+// later, so the CPU never waits on the GPU. Each result is added to a profiler counter in microseconds.
+// Begin and end it every frame, even around nothing, or the ring catches up with queries still in flight.
+class GpuTimer {
+public:
+	explicit GpuTimer(ProfileCounter _counter) : counter(_counter) {}
+
+	void begin();
+	void end();
+
+private:
+	static const unsigned int ringSize = 4;
+
+	ProfileCounter counter;
+	unsigned int startQueries[ringSize];
+	unsigned int endQueries[ringSize];
+	bool used[ringSize] = {};
+	unsigned int next = 0;
+	bool created = false;
+};
+
+#endif
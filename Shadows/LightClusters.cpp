@@ -0,0 +1,211 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LightClusters::configure()
+{
+	glGenBuffers(1, &lightDataBuffer);
+	glGenBuffers(1, &clusterGridBuffer);
+	glGenBuffers(1, &lightIndicesBuffer);
+	glGenTextures(1, &lightDataTexture);
+	glGenTextures(1, &clusterGridTexture);
+	glGenTextures(1, &lightIndicesTexture);
+
+	// allocate something so the texture buffers are complete before the first update
+	unsigned int zero[4] = { 0, 0, 0, 0 };
+	uploadBuffer(lightDataBuffer, zero, sizeof(zero));
+	uploadBuffer(clusterGridBuffer, zero, sizeof(zero));
+	uploadBuffer(lightIndicesBuffer, zero, sizeof(zero));
+
+	// light data: 8 texels per light (position + radius, ambient + constant, diffuse + linear, specular + quadratic,
+	// shadow slot + far plane + atlas tile size, atlas tile origins of the six faces)
+	glBindTexture(GL_TEXTURE_BUFFER, lightDataTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightDataBuffer);
+	// cluster grid: offset into the index list and number of lights per cluster
+	glBindTexture(GL_TEXTURE_BUFFER, clusterGridTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clusterGridBuffer);
+	// light index list, grouped by cluster
+	glBindTexture(GL_TEXTURE_BUFFER, lightIndicesTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, lightIndicesBuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	clusterGrid.assign(clusterCount * 2, 0);
+	clusterCounts.assign(clusterCount, 0);
+}
+
+void LightClusters::update(const std::vector<PointLight> &_lights, glm::mat4 _view, glm::mat4 _projection, float _nearPlane, float _farPlane,
+	const std::vector<glm::vec4> &_shadows)
+{
+	if (_projection != clusterProjection || _nearPlane != nearPlane || _farPlane != farPlane)
+		buildClusterBounds(_projection, _nearPlane, _farPlane);
+
+	lightCount = (unsigned int)_lights.size();
+	lightData.clear();
+	lightClusterPairs.clear();
+
+	for (unsigned int i = 0; i < lightCount; i++)
+	{
+		const PointLight &light = _lights[i];
+		float radius = light.getRadius(lightCutoff);
+
+		lightData.push_back(glm::vec4(light.position, radius));
+		lightData.push_back(glm::vec4(light.ambient, light.constant));
+		lightData.push_back(glm::vec4(light.diffuse, light.linear));
+		lightData.push_back(glm::vec4(light.specular, light.quadratic));
+		for (unsigned int j = 0; j < shadowTexels; j++)
+		{
+			unsigned int texel = i * shadowTexels + j;
+			if (texel < _shadows.size())
+				lightData.push_back(_shadows[texel]);
+			else
+				lightData.push_back(j == 0 ? glm::vec4(-1.0f, 1.0f, 0.0f, 0.0f) : glm::vec4(0.0f));
+		}
+
+		// depth range of the light's sphere (view space looks down -z)
+		glm::vec3 center = glm::vec3(_view * glm::vec4(light.position, 1.0f));
+		float minDepth = -center.z - radius;
+		float maxDepth = -center.z + radius;
+		if (radius <= 0.0f || maxDepth < nearPlane || minDepth > farPlane)
+			continue;
+
+		unsigned int firstSlice = sliceFromDepth(std::max(minDepth, nearPlane));
+		unsigned int lastSlice = sliceFromDepth(std::min(maxDepth, farPlane));
+
+		// screen tiles covered by the sphere, every tile if it reaches behind the near plane
+		unsigned int firstTileX = 0, lastTileX = tilesX - 1;
+		unsigned int firstTileY = 0, lastTileY = tilesY - 1;
+		if (minDepth > nearPlane)
+		{
+			glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+			for (int corner = 0; corner < 4; corner++)
+			{
+				float depth = (corner & 1) ? maxDepth : minDepth;
+				float sign = (corner & 2) ? 1.0f : -1.0f;
+				glm::vec2 ndc((center.x + sign * radius) * clusterProjection[0][0] / depth,
+					(center.y + sign * radius) * clusterProjection[1][1] / depth);
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+			if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+				continue;
+
+			ndcMin = glm::clamp(ndcMin, glm::vec2(-1.0f), glm::vec2(1.0f));
+			ndcMax = glm::clamp(ndcMax, glm::vec2(-1.0f), glm::vec2(1.0f));
+			firstTileX = std::min((unsigned int)((ndcMin.x * 0.5f + 0.5f) * tilesX), tilesX - 1);
+			lastTileX = std::min((unsigned int)((ndcMax.x * 0.5f + 0.5f) * tilesX), tilesX - 1);
+			firstTileY = std::min((unsigned int)((ndcMin.y * 0.5f + 0.5f) * tilesY), tilesY - 1);
+			lastTileY = std::min((unsigned int)((ndcMax.y * 0.5f + 0.5f) * tilesY), tilesY - 1);
+		}
+
+		for (unsigned int z = firstSlice; z <= lastSlice; z++)
+			for (unsigned int y = firstTileY; y <= lastTileY; y++)
+				for (unsigned int x = firstTileX; x <= lastTileX; x++)
+				{
+					unsigned int cluster = x + y * tilesX + z * tilesX * tilesY;
+					// sphere vs cluster AABB
+					glm::vec3 closest = glm::clamp(center, clusterMin[cluster], clusterMax[cluster]);
+					glm::vec3 offset = closest - center;
+					if (glm::dot(offset, offset) > radius * radius)
+						continue;
+
+					lightClusterPairs.push_back(cluster);
+					lightClusterPairs.push_back(i);
+				}
+	}
+
+	// count lights per cluster, then turn the counts into offsets and scatter the light indices
+	std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+	for (size_t i = 0; i < lightClusterPairs.size(); i += 2)
+		clusterCounts[lightClusterPairs[i]]++;
+
+	unsigned int offset = 0;
+	for (unsigned int i = 0; i < clusterCount; i++)
+	{
+		clusterGrid[i * 2] = offset;
+		clusterGrid[i * 2 + 1] = clusterCounts[i];
+		offset += clusterCounts[i];
+		clusterCounts[i] = clusterGrid[i * 2];
+	}
+
+	lightIndices.resize(offset);
+	for (size_t i = 0; i < lightClusterPairs.size(); i += 2)
+		lightIndices[clusterCounts[lightClusterPairs[i]]++] = lightClusterPairs[i + 1];
+
+	if (!lightData.empty())
+		uploadBuffer(lightDataBuffer, &lightData[0], lightData.size() * sizeof(glm::vec4));
+	uploadBuffer(clusterGridBuffer, &clusterGrid[0], clusterGrid.size() * sizeof(unsigned int));
+	if (!lightIndices.empty())
+		uploadBuffer(lightIndicesBuffer, &lightIndices[0], lightIndices.size() * sizeof(unsigned int));
+}
+
+void LightClusters::bindTextures(Shader _shader)
+{
+	_shader.setInt("clusterTilesX", tilesX);
+	_shader.setInt("clusterTilesY", tilesY);
+	_shader.setInt("clusterSlices", slicesZ);
+	// slice = log(depth) * scale + bias
+	float logRange = std::log(farPlane / nearPlane);
+	_shader.setFloat("clusterSliceScale", slicesZ / logRange);
+	_shader.setFloat("clusterSliceBias", -(float)slicesZ * std::log(nearPlane) / logRange);
+
+	glActiveTexture(GL_TEXTURE0 + lightDataUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, lightDataTexture);
+	glActiveTexture(GL_TEXTURE0 + clusterGridUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, clusterGridTexture);
+	glActiveTexture(GL_TEXTURE0 + lightIndicesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, lightIndicesTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// computes the view space AABB of every cluster for the given projection
+void LightClusters::buildClusterBounds(glm::mat4 _projection, float _nearPlane, float _farPlane)
+{
+	clusterProjection = _projection;
+	nearPlane = _nearPlane;
+	farPlane = _farPlane;
+
+	clusterMin.resize(clusterCount);
+	clusterMax.resize(clusterCount);
+
+	for (unsigned int z = 0; z < slicesZ; z++)
+	{
+		float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / slicesZ);
+		float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / slicesZ);
+
+		for (unsigned int y = 0; y < tilesY; y++)
+			for (unsigned int x = 0; x < tilesX; x++)
+			{
+				glm::vec2 ndcMin(-1.0f + 2.0f * x / tilesX, -1.0f + 2.0f * y / tilesY);
+				glm::vec2 ndcMax(-1.0f + 2.0f * (x + 1) / tilesX, -1.0f + 2.0f * (y + 1) / tilesY);
+
+				glm::vec3 boundsMin(1.0e30f), boundsMax(-1.0e30f);
+				for (int corner = 0; corner < 8; corner++)
+				{
+					float depth = (corner & 4) ? sliceFar : sliceNear;
+					glm::vec2 ndc((corner & 1) ? ndcMax.x : ndcMin.x, (corner & 2) ? ndcMax.y : ndcMin.y);
+					glm::vec3 point(ndc.x * depth / clusterProjection[0][0], ndc.y * depth / clusterProjection[1][1], -depth);
+					boundsMin = glm::min(boundsMin, point);
+					boundsMax = glm::max(boundsMax, point);
+				}
+
+				unsigned int cluster = x + y * tilesX + z * tilesX * tilesY;
+				clusterMin[cluster] = boundsMin;
+				clusterMax[cluster] = boundsMax;
+			}
+	}
+}
+
+unsigned int LightClusters::sliceFromDepth(float _depth)
+{
+	float slice = std::log(_depth / nearPlane) / std::log(farPlane / nearPlane) * slicesZ;
+	return std::min((unsigned int)std::max(slice, 0.0f), slicesZ - 1);
+}
+
+void LightClusters::uploadBuffer(unsigned int _buffer, const void *_data, size_t _size)
+{
+	// respecifying the whole store orphans last frame's data instead of waiting on draws still reading it
+	glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+	glBufferData(GL_TEXTURE_BUFFER, _size, _data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
@@ -0,0 +1,67 @@
+#ifndef _LIGHTCLUSTERS_H_
+#define _LIGHTCLUSTERS_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Shader.h"
+#include "PointLight.h"
+
+#include <vector>
+
+// Splits the view frustum into a grid of clusters (screen tiles x exponential depth slices) and
+// assigns every light to the clusters its range touches. The result is stored in texture buffers
+// so the fragment shader only has to loop over the lights of its own cluster.
+class LightClusters {
+public:
+	static const unsigned int tilesX = 16;
+	static const unsigned int tilesY = 9;
+	static const unsigned int slicesZ = 24;
+	static const unsigned int clusterCount = tilesX * tilesY * slicesZ;
+
+	// texture units the cluster buffers are bound to, kept clear of the material textures
+	static const unsigned int lightDataUnit = 13;
+	static const unsigned int clusterGridUnit = 14;
+	static const unsigned int lightIndicesUnit = 15;
+
+	// texels of shadow data per light, after the four of the light itself
+	static const unsigned int shadowTexels = 4;
+
+	// fraction of a light's brightness at which it is considered out of range
+	float lightCutoff = 1.0f / 64.0f;
+
+	void configure();
+	// _shadows has shadowTexels per light, see ShadowManager and ShadowAtlas, lights past its end are unshadowed
+	void update(const std::vector<PointLight> &_lights, glm::mat4 _view, glm::mat4 _projection, float _nearPlane, float _farPlane,
+		const std::vector<glm::vec4> &_shadows = std::vector<glm::vec4>());
+	void bindTextures(Shader _shader);
+
+	unsigned int getLightCount() { return lightCount; }
+	unsigned int getIndexCount() { return (unsigned int)lightIndices.size(); }
+
+private:
+	unsigned int lightDataBuffer, clusterGridBuffer, lightIndicesBuffer;
+	unsigned int lightDataTexture, clusterGridTexture, lightIndicesTexture;
+
+	// view space bounds of every cluster, rebuilt when the projection changes
+	std::vector<glm::vec3> clusterMin;
+	std::vector<glm::vec3> clusterMax;
+	glm::mat4 clusterProjection = glm::mat4(0.0f);
+	float nearPlane = 0.0f;
+	float farPlane = 0.0f;
+
+	unsigned int lightCount = 0;
+	std::vector<glm::vec4> lightData;
+	std::vector<unsigned int> clusterGrid;
+	std::vector<unsigned int> lightIndices;
+	std::vector<unsigned int> clusterCounts;
+	std::vector<unsigned int> lightClusterPairs;
+
+	void buildClusterBounds(glm::mat4 _projection, float _nearPlane, float _farPlane);
+	unsigned int sliceFromDepth(float _depth);
+	void uploadBuffer(unsigned int _buffer, const void *_data, size_t _size);
+};
+
+#endif
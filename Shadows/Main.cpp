@@ -6,6 +6,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
 
 #include "Camera.h"
 #include "Model.h"
@@ -16,12 +18,43 @@
 #include "Skybox.h"
 #include "TransformComponent.h"
 #include "shadowFBO.h"
+#include "ShadowMoments.h"
+#include "ShadowManager.h"
+#include "ShadowAtlas.h"
+#include "ShadowBenchmark.h"
+#include "PointLight.h"
+#include "LightClusters.h"
+#include "CommandRecorder.h"
+#include "StaticBatch.h"
+#include "Profiler.h"
+#include "GpuTimer.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQueries.h"
+#include "SoftwareOcclusion.h"
 
 void setCameraViewTransforms(Shader _shader);
+glm::mat4 getCameraProjection();
+float getCameraPixelScale();
 
 void addObjects();
-void shadowPass(Shader _shader, Room _room);
-void renderPass(Shader _shader, Room _room);
+void placeLight(glm::vec3 _position);
+float fitShadowFarPlane(glm::vec3 _lightPos, float _nearPlane, float _lightRadius);
+void buildSceneBVH();
+bool updateSceneBVH();
+void countQueryCulled(size_t _found);
+void gatherVisibleMeshes(const std::vector<unsigned int> &_items);
+void cullSmallItems(std::vector<unsigned int> &_items, const CullView &_view);
+// which casters a shadow pass draws: the static ones are cached apart from the dynamic ones
+enum class ShadowCasters { All, Static, Dynamic };
+void recordShadowPass(Shader _shader, Room _room, const CullView &_view, const std::vector<unsigned int> &_casters, ShadowCasters _which,
+	bool _withRoom = true);
+void shadowPass(Shader _shader, Room _room, const CullView &_view, const std::vector<unsigned int> &_casters, ShadowCasters _which);
+void recordPointShadow(Shader _shader, Room _room, glm::vec3 _position, float _range, unsigned int _resolution,
+	const std::vector<glm::mat4> &_faceMatrices, bool _withRoom = true);
+void drawAtlasShadows(ShadowProjection _projection, Shader _cubeShader, Shader _paraboloidShader, Room _room);
+void occlusionQueryPass(Shader _shader, const CullView &_view);
+void renderPass(Shader _shader, Room _room, const CullView &_view);
 
 void renderScene(Shader _shader, Room _room, Model _model, Cube _cube, bool withTextures);
 void renderSkybox(Skybox _skybox, Shader _shader);
@@ -37,9 +70,73 @@ bool displayDepth = false;
 bool displayDepthKeyPressed = false;
 bool MoveLight = true;
 bool MoveLightKeypressed = false;
+bool PlaceLightKeyPressed = false;
+bool ClearLightsKeyPressed = false;
+bool ProfilerKeyPressed = false;
+bool OcclusionKeyPressed = false;
+bool QueriesKeyPressed = false;
+bool SoftwareOcclusionKeyPressed = false;
+bool ShadowResolutionKeyPressed = false;
+bool ShadowFormatKeyPressed = false;
+bool ShadowFilterKeyPressed = false;
+bool ShadowAtlasKeyPressed = false;
+bool ShadowProjectionKeyPressed = false;
+bool ShadowBenchmarkKeyPressed = false;
+// how PLTest.frag filters the shadow cubemap, the values match its shadowFilter uniform
+enum ShadowFilter { ShadowFilterPCF, ShadowFilterHardwarePCF, ShadowFilterVariance, ShadowFilterCount };
+int shadowFilter = ShadowFilterHardwarePCF;
+// screen space error the LOD selection accepts, the shadow pass is blurred by filtering anyway so it goes coarser
+const float cameraLodPixelError = 1.0f;
+const float shadowLodPixelError = 4.0f;
+// meshes smaller than this many pixels across are skipped, a small caster barely changes a shadow map texel
+const float cameraMinPixelSize = 2.0f;
+const float shadowMinPixelSize = 6.0f;
+// the shadow casting light ends where its attenuation drops below this, casters and the far plane stop there
+const float shadowLightCutoff = 1.0f / 64.0f;
 
 // Shadow framebuffer object class
 ShadowFBO shadowFBO;
+// what the shadow pass costs on the GPU, shown with the profiler's counters
+GpuTimer shadowTimer(ProfileCounter::ShadowPassMicroseconds);
+// blurred depth moments of the shadow cubemap, for the variance shadow filter
+ShadowMoments shadowMoments;
+// shadow slots for the clustered lights that matter most on screen
+ShadowManager shadowManager;
+// or tiles of a shadow atlas sized by each light's screen coverage, G switches between the two
+ShadowAtlas shadowAtlas;
+bool useShadowAtlas = true;
+bool shadowStorageSwitched = false;
+// projection of the placed lights' atlas tiles, K steps through them
+ShadowProjection placedLightProjection = ShadowProjection::Automatic;
+// GPU time of the clustered lights' cube maps and dual paraboloids apart, B compares the two
+GpuTimer cubeShadowTimer(ProfileCounter::CubeShadowMicroseconds);
+GpuTimer paraboloidShadowTimer(ProfileCounter::ParaboloidShadowMicroseconds);
+ShadowBenchmark shadowBenchmark;
+// Chebyshev upper bounds below this fraction count as fully shadowed, cuts light bleeding between overlapping casters
+const float varianceBleedReduction = 0.3f;
+
+// Clustered point lights, shaded on top of the shadow casting light
+LightClusters lightClusters;
+std::vector<PointLight> lights;
+
+// Records the passes on worker threads, replayed on this one
+CommandRecorder commandRecorder;
+
+// Hi-Z occlusion culling of the camera pass' meshlets, on when the context has GL 4.3
+OcclusionCuller occlusionCuller;
+// bounding box queries for heavy models, the fallback when the culler isn't running
+OcclusionQueries occlusionQueries;
+// CPU depth buffer of the walls and big furniture, tests the camera pass' boxes before they're recorded
+SoftwareOcclusion softwareOcclusion;
+
+// World space geometry of the static objects and the room
+StaticBatch staticBatch;
+
+// BVH over the meshes of the dynamic objects and the static batches, items are owned by an object index or by
+// objects.size() for the static batch
+SceneBVH sceneBVH;
+std::vector<unsigned int> objectFirstItem;
+std::vector<std::vector<unsigned int>> visibleMeshes;	// per owner, what the current pass' BVH query found
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f), -90.0f, 0.0f);
@@ -89,20 +186,40 @@ int main() {
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
+	// filtered shadow lookups near a cube edge blend in the neighbouring face
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
 	//// configure depth map FBO
 	shadowFBO.configureFBO();
+	shadowMoments.configure();
+	shadowManager.configure();
+	shadowAtlas.configure();
+	lightClusters.configure();
+	commandRecorder.configure();
+	occlusionCuller.configure(screenWidth, screenHeight);
+	occlusionQueries.configure();
 
 	//Create shaders and objects
 	Shader skyboxShader("Shaders/skybox.vert", "Shaders/skybox.frag");
 	Shader shader("Shaders/pointLShadows.vert", "Shaders/PLTest.frag");
 	Shader simpleDepthShader("Shaders/pointLShadowsDepth.vert", "Shaders/pointLShadowsDepth.frag","Shaders/pointLShadowsDepth.geo");
+	Shader paraboloidDepthShader("Shaders/pointLShadowsParaboloid.vert", "Shaders/pointLShadowsDepth.frag");
+	Shader prepassShader("Shaders/depthPrepass.vert", "Shaders/depthPrepass.frag");
 
 	// shader configuration
 	// --------------------
 	shader.use();
 	shader.setInt("diffuseTexture", 0);
-	shader.setInt("depthMap", 1);
+	shader.setInt("depthMap", ShadowFBO::textureUnit);
+	shader.setInt("depthMapShadow", ShadowFBO::compareTextureUnit);
+	shader.setInt("momentsMap", ShadowMoments::textureUnit);
+	shader.setInt("lightShadows", ShadowManager::textureUnit);
+	shader.setInt("shadowAtlas", ShadowAtlas::textureUnit);
+	shader.setFloat("bleedReduction", varianceBleedReduction);
+	shader.setInt("lightData", LightClusters::lightDataUnit);
+	shader.setInt("clusterGrid", LightClusters::clusterGridUnit);
+	shader.setInt("lightIndices", LightClusters::lightIndicesUnit);
+	shader.setVec2("screenSize", (float)screenWidth, (float)screenHeight);
 
 	//Add all models
 	addObjects();
@@ -115,6 +232,36 @@ int main() {
 	//room.loadTexture("Textures/whiteness.jpg");
 	room.setScale(glm::vec3(10.0f,5.0f,10.0f));
 	room.setPos(glm::vec3(0.0f,5.0f,0.0f));
+	room.setStatic(true);
+
+	// bake everything that doesn't move into world space batches
+	room.addToBatch(staticBatch);
+	for (unsigned int i = 0; i < objects.size(); i++)
+		if (objects[i].getStatic())
+			staticBatch.addMeshes(objects[i].meshes, objects[i].getModel());
+	staticBatch.build();
+	buildSceneBVH();
+
+	// the room and the big furniture hide most of the scene from most places
+	room.addToOcclusion(softwareOcclusion);
+	for (unsigned int i = 0; i < objects.size(); i++)
+		if (objects[i].getOccluder())
+			for (unsigned int j = 0; j < objects[i].meshes.size(); j++)
+				softwareOcclusion.addMesh(objects[i].meshes[j], objects[i].getModel());
+
+	// the passes are recorded off the GL thread, so look up every uniform they set now
+	std::vector<std::string> uniformNames = { "model", "positionOffset", "positionScale", "faceMask", "useMaterialColor", "materialColor" };
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		std::vector<std::string> samplerNames = objects[i].getSamplerNames();
+		uniformNames.insert(uniformNames.end(), samplerNames.begin(), samplerNames.end());
+	}
+	std::vector<std::string> batchSamplerNames = staticBatch.getSamplerNames();
+	uniformNames.insert(uniformNames.end(), batchSamplerNames.begin(), batchSamplerNames.end());
+	shader.cacheUniformLocations(uniformNames);
+	simpleDepthShader.cacheUniformLocations(uniformNames);
+	paraboloidDepthShader.cacheUniformLocations(uniformNames);
+	prepassShader.cacheUniformLocations(uniformNames);
 
 	// Skybox textures
 	std::vector<std::string> faces
@@ -131,6 +278,13 @@ int main() {
 	// lighting info
 	// -------------
 	glm::vec3 lightPos(2.0f, 1.0f, 5.0f);
+	PointLight shadowLight;
+	shadowLight.ambient = glm::vec3(0.2f);
+	shadowLight.diffuse = glm::vec3(1.0f);
+	shadowLight.specular = glm::vec3(1.0f);
+	shadowLight.constant = 1.0f;
+	shadowLight.linear = 0.045f;
+	shadowLight.quadratic = 0.0075f;
 
 	// Render Loop
 	while (!glfwWindowShouldClose(window))
@@ -153,10 +307,16 @@ int main() {
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		// catch the BVH up with anything that moved
+		bool dynamicMoved = updateSceneBVH();
+
 		// 0. create depth cubemap transformation matrices
 		// -----------------------------------------------
+		// the cubemap only has to reach as far as the light does and as far as there is anything to hit
+		shadowLight.position = lightPos;
+		float lightRadius = shadowLight.getRadius(shadowLightCutoff);
 		float near_plane = 1.0f;
-		float far_plane = 100.0f;
+		float far_plane = fitShadowFarPlane(lightPos, near_plane, lightRadius);
 
 		shadowFBO.createCubemapTransformationMatrices(lightPos,near_plane,far_plane);
 
@@ -165,39 +325,154 @@ int main() {
 		/*glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
 		glClear(GL_DEPTH_BUFFER_BIT);*/
+		shadowTimer.begin();
 		simpleDepthShader.use();
-		shadowFBO.bindFBO(simpleDepthShader);
 		simpleDepthShader.setFloat("far_plane", far_plane);
 		simpleDepthShader.setVec3("lightPos", lightPos);
-		shadowPass(simpleDepthShader, room);
+		// casters past far_plane can't land in the cubemap, so the BVH query and the meshlets stop there too
+		CullView lightView;
+		lightView.position = lightPos;
+		lightView.range = far_plane;
+		// a cube face spans 90 degrees, shadows get a coarser LOD than the camera would pick
+		lightView.pixelScale = shadowFBO.resolution * 0.5f;
+		lightView.lodPixelError = shadowLodPixelError;
+		lightView.minPixelSize = shadowMinPixelSize;
+		// each caster only goes to the cube faces it touches
+		SimdFrustum cubeFaces[6];
+		for (unsigned int i = 0; i < 6; i++)
+			cubeFaces[i] = SimdFrustum(Frustum(shadowFBO.shadowTransforms[i]));
+		lightView.faceFrusta = cubeFaces;
+
+		// casters are whatever the light's range reaches
+		std::vector<unsigned int> casters;
+		sceneBVH.querySphere(lightView.position, lightView.range, casters);
+		countQueryCulled(casters.size());
+		cullSmallItems(casters, lightView);
+		bool dynamicCasters = !room.getStatic();
+		for (unsigned int i = 0; i < casters.size() && !dynamicCasters; i++)
+			dynamicCasters = sceneBVH.getItems()[casters[i]].owner < objects.size();
+
+		// a moving light draws everything each frame, a parked one keeps the static casters cached and only
+		// redraws the dynamic ones over them when they move
+		if (shadowFBO.setLight(lightPos, near_plane, far_plane))
+		{
+			shadowFBO.bindFBO(simpleDepthShader);
+			shadowPass(simpleDepthShader, room, lightView, casters, ShadowCasters::All);
+		}
+		else
+		{
+			bool staticRedrawn = !shadowFBO.isStaticCached();
+			if (staticRedrawn)
+			{
+				shadowFBO.bindStaticFBO(simpleDepthShader);
+				shadowPass(simpleDepthShader, room, lightView, casters, ShadowCasters::Static);
+			}
+			if (!dynamicCasters)
+				shadowFBO.useStaticMap();
+			else if (staticRedrawn || dynamicMoved || !shadowFBO.isCompositeCached())
+			{
+				shadowFBO.bindCompositeFBO(simpleDepthShader);
+				shadowPass(simpleDepthShader, room, lightView, casters, ShadowCasters::Dynamic);
+			}
+		}
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// the clustered lights lighting the most of the screen get shadows, a few are redrawn per frame. Whichever
+		// storage was idle missed what moved meanwhile, so it starts over
+		glm::mat4 cameraViewProjection = getCameraProjection() * camera.GetViewMatrix();
+		bool shadowsInvalid = dynamicMoved || shadowStorageSwitched;
+		shadowStorageSwitched = false;
+		if (useShadowAtlas)
+		{
+			// the benchmark holds every light to one projection and redraws them all
+			shadowAtlas.forcedProjection = shadowBenchmark.getProjection();
+			shadowAtlas.updateAll = shadowBenchmark.isRunning();
+			shadowAtlas.assign(lights, lightClusters.lightCutoff, cameraViewProjection, camera.position, getCameraPixelScale(), shadowsInvalid);
+		}
+		else
+			shadowManager.assign(lights, lightClusters.lightCutoff, cameraViewProjection, camera.position, shadowsInvalid);
+
+		cubeShadowTimer.begin();
+		if (useShadowAtlas)
+			drawAtlasShadows(ShadowProjection::Cube, simpleDepthShader, paraboloidDepthShader, room);
+		else
+		{
+			simpleDepthShader.use();
+			for (unsigned int slot : shadowManager.getPendingSlots())
+			{
+				shadowManager.bindSlot(slot, simpleDepthShader);
+				recordPointShadow(simpleDepthShader, room, shadowManager.getSlotPosition(slot), shadowManager.getSlotRange(slot),
+					ShadowManager::resolution, shadowManager.getSlotMatrices(slot));
+				commandRecorder.replay();
+			}
+		}
+		cubeShadowTimer.end();
+		paraboloidShadowTimer.begin();
+		if (useShadowAtlas)
+			drawAtlasShadows(ShadowProjection::DualParaboloid, simpleDepthShader, paraboloidDepthShader, room);
+		paraboloidShadowTimer.end();
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (shadowFilter == ShadowFilterVariance)
+			shadowMoments.update(shadowFBO.getSampledCubemap(), shadowFBO.getVersion());
+		shadowTimer.end();
 				
 		// 2. render scene as normal 
 		// -------------------------
+		// with occlusion culling on the pass goes offscreen so its depth can build the pyramid
+		bool occlusionCulling = occlusionCuller.isEnabled();
 		glViewport(0, 0, screenWidth, screenHeight);
+		if (occlusionCulling)
+			occlusionCuller.bindFramebuffer();
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		shader.use();
 		setCameraViewTransforms(shader);
 
 		//shader.setVec3("lightPos", lightPos);
 		shader.setInt("displayDepth", displayDepth); // enable/disable shadows by pressing 'SPACE'
+		shader.setInt("shadowFilter", shadowFilter);
 		shader.setFloat("far_plane", far_plane);
+		shader.setFloat("lightRadius", lightRadius);
 
 		//shader.setInt("material.diffuse", 0);
 		//shader.setInt("material.specular", 1);
 		//shader.setFloat("material.shininess", 32.0f);
 
-		shader.setVec3("pointLight.position", lightPos);
-		shader.setVec3("pointLight.ambient", 0.2f, 0.2f, 0.2f);
-		shader.setVec3("pointLight.diffuse", 1.0f, 1.0f, 1.0f);
-		shader.setVec3("pointLight.specular", 1.0f, 1.0f, 1.0f);
-		shader.setFloat("pointLight.constant", 1.0f);
-		shader.setFloat("pointLight.linear", 0.045f);
-		shader.setFloat("pointLight.quadratic", 0.0075f);
+		shader.setVec3("pointLight.position", shadowLight.position);
+		shader.setVec3("pointLight.ambient", shadowLight.ambient);
+		shader.setVec3("pointLight.diffuse", shadowLight.diffuse);
+		shader.setVec3("pointLight.specular", shadowLight.specular);
+		shader.setFloat("pointLight.constant", shadowLight.constant);
+		shader.setFloat("pointLight.linear", shadowLight.linear);
+		shader.setFloat("pointLight.quadratic", shadowLight.quadratic);
 
-		renderPass(shader, room);
+		// assign the placed lights to clusters of the camera frustum
+		lightClusters.update(lights, camera.GetViewMatrix(), getCameraProjection(), 0.1f, 100.0f,
+			useShadowAtlas ? shadowAtlas.getShadowData() : shadowManager.getShadowData());
+		lightClusters.bindTextures(shader);
+
+		CullView cameraView;
+		cameraView.position = camera.position;
+		cameraView.useFrustum = true;
+		cameraView.viewProjection = cameraViewProjection;
+		cameraView.pixelScale = getCameraPixelScale();
+		cameraView.lodPixelError = cameraLodPixelError;
+		cameraView.minPixelSize = cameraMinPixelSize;
+		cameraView.gpuOcclusion = occlusionCulling;
+		occlusionQueries.beginFrame((unsigned int)objects.size());
+		if (occlusionQueries.isEnabled() && !occlusionCulling)
+		{
+			occlusionQueryPass(prepassShader, cameraView);
+			shader.use();
+		}
+		renderPass(shader, room, cameraView);
 
 		renderSkybox(skybox,skyboxShader);
+		if (occlusionCulling)
+			occlusionCuller.present();
+
+		profiler.endFrame(currentFrame);
+		shadowBenchmark.endFrame();
 
 		// check and call events and swap the buffers
 		glfwPollEvents();
@@ -219,6 +494,7 @@ void addObjects() {
 	objects.push_back(Model("Models/obj_mesa/obj_mesa.obj"));
 	objects[0].setScale(glm::vec3(4.0f));
 	objects[0].setPos(glm::vec3(7.5f, 0.0f, 5.0f));
+	objects[0].setStatic(true);
 
 	objects.push_back(Model("Models/coffeeMug/coffeMug1_free_obj.obj"));
 	objects[1].setScale(glm::vec3(0.02f));
@@ -227,29 +503,159 @@ void addObjects() {
 	objects.push_back(Model("Models/bed/krovat-2.obj"));
 	objects[2].setScale(glm::vec3(5.0f));
 	objects[2].setPos(glm::vec3(-5.0f, 0.0f, 5.0f));
+	objects[2].setStatic(true);
+	objects[2].setOccluder(true);
 	
 	objects.push_back(Model("Models/wardrobe/Wardrobe  4 door.obj"));
 	objects[3].setScale(glm::vec3(4.0f));
 	objects[3].setPos(glm::vec3(-5.0f, 0.0f, -10.0f));
+	objects[3].setStatic(true);
+	objects[3].setOccluder(true);
 
 	objects.push_back(Model("Models/Samus/DolSzerosuitR1.obj"));
 	objects[4].setScale(glm::vec3(0.4f));
 	objects[4].setPos(glm::vec3(0.0f, 0.0f, 0.0f));
+	objects[4].setOcclusionQuery(true);
+	objects[4].setContributionScale(0.0f);
 
 	objects.push_back(Model("Models/picture/frida.obj"));
 	objects[5].setScale(glm::vec3(7.5f));
 	objects[5].setPos(glm::vec3(-3.0f, -4.0f, -12.2f));
+	objects[5].setStatic(true);
 
 	objects.push_back(Model("Models/picture/frame.obj"));
 	objects[6].setScale(glm::vec3(7.5f));
 	objects[6].setPos(glm::vec3(-3.0f, -4.0f, -12.2f));
+	objects[6].setStatic(true);
+
+}
+
+// distance to the furthest corner of the scene bounds, capped at the light's radius. Depth is stored as
+// distance / far_plane, so a tight far plane is free precision.
+float fitShadowFarPlane(glm::vec3 _lightPos, float _nearPlane, float _lightRadius)
+{
+	glm::vec3 boundsMin, boundsMax;
+	if (!sceneBVH.getBounds(boundsMin, boundsMax))
+		return std::max(_lightRadius, _nearPlane * 2.0f);
+
+	glm::vec3 furthest = glm::max(glm::abs(boundsMin - _lightPos), glm::abs(boundsMax - _lightPos));
+	float sceneReach = glm::length(furthest) * 1.01f;
+	return std::max(std::min(sceneReach, _lightRadius), _nearPlane * 2.0f);
+}
+
+// one BVH item per mesh of every dynamic object and per static batch
+void buildSceneBVH()
+{
+	std::vector<BVHItem> items;
+	objectFirstItem.assign(objects.size(), 0);
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		objectFirstItem[i] = (unsigned int)items.size();
+		if (objects[i].getStatic())
+			continue;
+		for (unsigned int j = 0; j < objects[i].meshes.size(); j++)
+		{
+			glm::vec3 center, extents;
+			transformBounds(objects[i].getModel(), objects[i].meshes[j].boundsMin, objects[i].meshes[j].boundsMax, center, extents);
+			items.push_back({ center - extents, center + extents, i, j });
+		}
+		objects[i].clearDirty();
+	}
+	const std::vector<Mesh> &batches = staticBatch.getMeshes();
+	for (unsigned int j = 0; j < batches.size(); j++)
+		items.push_back({ batches[j].boundsMin, batches[j].boundsMax, (unsigned int)objects.size(), j });
+
+	sceneBVH.build(items);
+	visibleMeshes.resize(objects.size() + 1);
+}
 
+// moves the items of objects whose transform changed and refits, true when anything moved
+bool updateSceneBVH()
+{
+	bool moved = false;
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].getStatic() || !objects[i].isDirty())
+			continue;
+		moved = true;
+		for (unsigned int j = 0; j < objects[i].meshes.size(); j++)
+		{
+			glm::vec3 center, extents;
+			transformBounds(objects[i].getModel(), objects[i].meshes[j].boundsMin, objects[i].meshes[j].boundsMax, center, extents);
+			sceneBVH.updateItem(objectFirstItem[i] + j, center - extents, center + extents);
+		}
+		objects[i].clearDirty();
+	}
+	sceneBVH.refit();
+	return moved;
+}
+
+// counts the items a BVH query left out as culled. Whatever drops items after the query counts those itself
+// (MeshesTooSmall, MeshesOccluded), so every rejected item lands in one counter
+void countQueryCulled(size_t _found)
+{
+	size_t itemCount = sceneBVH.getItems().size();
+	profiler.add(ProfileCounter::MeshesTested, (unsigned int)itemCount);
+	profiler.add(ProfileCounter::MeshesCulled, (unsigned int)(itemCount - _found));
+}
+
+// sorts the items a BVH query returned into per owner mesh lists for the recording threads
+void gatherVisibleMeshes(const std::vector<unsigned int> &_items)
+{
+	for (unsigned int i = 0; i < visibleMeshes.size(); i++)
+		visibleMeshes[i].clear();
+	const std::vector<BVHItem> &allItems = sceneBVH.getItems();
+	for (unsigned int i = 0; i < _items.size(); i++)
+		visibleMeshes[allItems[_items[i]].owner].push_back(allItems[_items[i]].mesh);
+	// keep the import order so draw order doesn't change with the tree
+	for (unsigned int i = 0; i < visibleMeshes.size(); i++)
+		std::sort(visibleMeshes[i].begin(), visibleMeshes[i].end());
+}
+
+// drops the items too small in _view to be worth drawing, by the sphere around each item's box
+void cullSmallItems(std::vector<unsigned int> &_items, const CullView &_view)
+{
+	if (_view.minPixelSize <= 0.0f)
+		return;
+	const std::vector<BVHItem> &allItems = sceneBVH.getItems();
+	size_t count = _items.size();
+	_items.erase(std::remove_if(_items.begin(), _items.end(), [&](unsigned int _item) {
+		const BVHItem &item = allItems[_item];
+		float scale = item.owner < objects.size() ? objects[item.owner].getContributionScale() : 1.0f;
+		return !contributes(_view, (item.boundsMin + item.boundsMax) * 0.5f, glm::length(item.boundsMax - item.boundsMin) * 0.5f, scale);
+	}), _items.end());
+	profiler.add(ProfileCounter::MeshesTooSmall, (unsigned int)(count - _items.size()));
+}
+
+// places a small coloured light, these are only shaded through the light clusters
+void placeLight(glm::vec3 _position)
+{
+	PointLight light;
+	light.position = _position;
+	light.diffuse = glm::vec3(0.3f + 0.7f * (rand() % 100) / 100.0f, 0.3f + 0.7f * (rand() % 100) / 100.0f, 0.3f + 0.7f * (rand() % 100) / 100.0f);
+	light.specular = light.diffuse;
+	light.ambient = light.diffuse * 0.05f;
+	light.linear = 0.7f;
+	light.quadratic = 1.8f;
+	light.shadowProjection = placedLightProjection;
+	lights.push_back(light);
+}
+
+glm::mat4 getCameraProjection()
+{
+	return glm::perspective(glm::radians(45.0f), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+}
+
+// pixels per unit of tangent at the screen's centre
+float getCameraPixelScale()
+{
+	return screenHeight * 0.5f / std::tan(glm::radians(45.0f) * 0.5f);
 }
 
 void setCameraViewTransforms(Shader _shader) 
 {
 	glm::mat4 view = camera.GetViewMatrix();
-	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+	glm::mat4 projection = getCameraProjection();
 
 	_shader.use();
 	_shader.setMat4("view", view);
@@ -257,40 +663,215 @@ void setCameraViewTransforms(Shader _shader)
 	_shader.setVec3("viewPos", camera.position);
 }
 
-void shadowPass(Shader _shader, Room _room)
+void recordShadowPass(Shader _shader, Room _room, const CullView &_view, const std::vector<unsigned int> &_casters, ShadowCasters _which,
+	bool _withRoom)
+{
+	int modelLocation = _shader.getCachedUniformLocation("model");
+	gatherVisibleMeshes(_casters);
+	bool withStatic = _which != ShadowCasters::Dynamic, withDynamic = _which != ShadowCasters::Static;
+
+	// objects are recorded in parallel, one command buffer per slice. The room and the static batch come last,
+	// static objects are drawn as part of the batch
+	commandRecorder.record((unsigned int)objects.size() + 2, [&](unsigned int _index, CommandBuffer &_commands) {
+		if (_index == objects.size() + 1) {
+			if (!withStatic)
+				return;
+			_commands.setUniform(modelLocation, glm::mat4(1.0f));
+			staticBatch.record(_commands, _shader, false, _view, &visibleMeshes[objects.size()], _withRoom);
+			return;
+		}
+		if (_index == objects.size()) {
+			if (!_room.getStatic() && withDynamic && _withRoom) {
+				_commands.setUniform(modelLocation, _room.getModel());
+				_commands.setUniform(_shader.getCachedUniformLocation("faceMask"), (int)allCubeFaces);
+				_room.record(_commands, _shader, false);
+			}
+			return;
+		}
+		if (objects[_index].getStatic() || visibleMeshes[_index].empty() || !withDynamic)
+			return;
+		_commands.setUniform(modelLocation, objects[_index].getModel());
+		objects[_index].RecordDepth(_commands, _shader, _view, &visibleMeshes[_index]);
+	});
+}
+
+void shadowPass(Shader _shader, Room _room, const CullView &_view, const std::vector<unsigned int> &_casters, ShadowCasters _which)
 {
-	glm::mat4 model = glm::mat4(1.0f);
+	recordShadowPass(_shader, _room, _view, _casters, _which);
+	commandRecorder.replay();
+}
 
-	for (int i = 0; i < objects.size(); i++) {
-		model = objects[i].getModel();
-		_shader.setMat4("model", model);
-		objects[i].Draw();
+// a clustered light's casters, whatever its range reaches, recorded for faces of _resolution. The depth
+// shader and the target are already bound, replaying draws them. The room can be left out, from inside it
+// can't shadow itself
+void recordPointShadow(Shader _shader, Room _room, glm::vec3 _position, float _range, unsigned int _resolution,
+	const std::vector<glm::mat4> &_faceMatrices, bool _withRoom)
+{
+	CullView view;
+	view.position = _position;
+	view.range = _range;
+	view.pixelScale = _resolution * 0.5f;
+	view.lodPixelError = shadowLodPixelError;
+	view.minPixelSize = shadowMinPixelSize;
+	// without face matrices every caster goes to every pass
+	SimdFrustum faces[6];
+	if (_faceMatrices.size() == 6)
+	{
+		for (unsigned int i = 0; i < 6; i++)
+			faces[i] = SimdFrustum(Frustum(_faceMatrices[i]));
+		view.faceFrusta = faces;
 	}
-	
-	model = _room.getModel();
-	_shader.setMat4("model", model);
-	_room.draw();
+
+	std::vector<unsigned int> casters;
+	sceneBVH.querySphere(view.position, view.range, casters);
+	countQueryCulled(casters.size());
+	cullSmallItems(casters, view);
+	recordShadowPass(_shader, _room, view, casters, ShadowCasters::All, _withRoom);
+	profiler.add(ProfileCounter::ShadowSlotsDrawn, 1);
+}
+
+// the atlas lights of one projection waiting to be drawn. A cube is replayed once per face with only that face's
+// triangles kept, a dual paraboloid once per half with the vertex shader folding it onto the tile. The paraboloid
+// folds per vertex, so the room's few huge triangles would come out far off the curved surface and shadow the
+// walls they belong to: they are left out, the room is convex and a light inside can't shadow it anyway
+void drawAtlasShadows(ShadowProjection _projection, Shader _cubeShader, Shader _paraboloidShader, Room _room)
+{
+	bool paraboloid = _projection == ShadowProjection::DualParaboloid;
+	Shader &shader = paraboloid ? _paraboloidShader : _cubeShader;
+	shader.use();
+	if (paraboloid)
+		glEnable(GL_CLIP_DISTANCE0);
+	for (unsigned int light : shadowAtlas.getPendingLights())
+	{
+		if (shadowAtlas.getProjection(light) != _projection)
+			continue;
+		shadowAtlas.bindLight(light, shader);
+		recordPointShadow(shader, _room, shadowAtlas.getLightPosition(light), shadowAtlas.getLightRange(light),
+			shadowAtlas.getTileSize(light), shadowAtlas.getLightMatrices(light), !paraboloid);
+		for (unsigned int face = 0; face < shadowAtlas.getFaceCount(light); face++)
+		{
+			shadowAtlas.bindFace(light, face, shader);
+			commandRecorder.replay();
+		}
+		if (paraboloid)
+			profiler.add(ProfileCounter::ParaboloidShadowsDrawn, 1);
+	}
+	glDisable(GL_CLIP_DISTANCE0);
 }
 
-void renderPass(Shader _shader, Room _room) {
-	glm::mat4 model = glm::mat4(1.0f);
+// depth of the static batch (room walls, wardrobe, bed...) and then the boxes of the models that use occlusion
+// queries tested against it
+void occlusionQueryPass(Shader _shader, const CullView &_view)
+{
+	int modelLocation = _shader.getCachedUniformLocation("model");
+	_shader.use();
+	_shader.setMat4("viewProjection", _view.viewProjection);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	CommandBuffer commands;
+	ReplayState occluderState;
+	commands.setUniform(modelLocation, glm::mat4(1.0f));
+	staticBatch.record(commands, _shader, false, _view);
+	commands.replay(occluderState);
 
-	for (int i = 0; i < objects.size(); i++) {
-		model = objects[i].getModel();
-		_shader.setMat4("model", model);
-		objects[i].DrawWithTextures(_shader, shadowFBO.depthCubemap);
+	// the boxes only test depth, they mustn't hide each other
+	commands.clear();
+	commands.setUniform(modelLocation, glm::mat4(1.0f));
+	SimdFrustum frustum(Frustum(_view.viewProjection));
+	for (unsigned int i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].getStatic() || !objects[i].getOcclusionQuery())
+			continue;
+		glm::vec3 center, extents;
+		transformBounds(objects[i].getModel(), objects[i].boundsMin, objects[i].boundsMax, center, extents);
+		if (frustum.intersectsBox(center, extents))
+			occlusionQueries.recordQuery(i, center - extents, center + extents, _view.position, commands, _shader);
 	}
-	
-	model = _room.getModel();
-	_shader.setMat4("model", model);
-	_room.bindTextures(shadowFBO.depthCubemap);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	ReplayState boxState;
+	commands.replay(boxState);
+	glEnable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindVertexArray(0);
+
+	// the colour pass draws the occluders again with a different vertex shader, its depth wouldn't match exactly
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void renderPass(Shader _shader, Room _room, const CullView &_view) {
+	int modelLocation = _shader.getCachedUniformLocation("model");
+
+	std::vector<unsigned int> items;
+	sceneBVH.queryFrustum(SimdFrustum(Frustum(_view.viewProjection)), items);
+	countQueryCulled(items.size());
+	cullSmallItems(items, _view);
+	if (softwareOcclusion.isEnabled())
+	{
+		softwareOcclusion.render(_view.viewProjection, commandRecorder);
+		const std::vector<BVHItem> &allItems = sceneBVH.getItems();
+		size_t inView = items.size();
+		items.erase(std::remove_if(items.begin(), items.end(), [&](unsigned int _item) {
+			return !softwareOcclusion.isVisible(allItems[_item].boundsMin, allItems[_item].boundsMax);
+		}), items.end());
+		profiler.add(ProfileCounter::MeshesOccluded, (unsigned int)(inView - items.size()));
+	}
+	gatherVisibleMeshes(items);
+
+	shadowFBO.bindTexture();
+	shadowMoments.bindTexture();
+	shadowManager.bindTexture();
+	shadowAtlas.bindTexture();
+
+	commandRecorder.record((unsigned int)objects.size() + 2, [&](unsigned int _index, CommandBuffer &_commands) {
+		if (_index == objects.size() + 1) {
+			_commands.setUniform(modelLocation, glm::mat4(1.0f));
+			staticBatch.record(_commands, _shader, true, _view, &visibleMeshes[objects.size()]);
+			return;
+		}
+		if (_index == objects.size()) {
+			if (!_room.getStatic()) {
+				_commands.setUniform(modelLocation, _room.getModel());
+				_room.record(_commands, _shader, true);
+			}
+			return;
+		}
+		if (objects[_index].getStatic() || visibleMeshes[_index].empty())
+			return;
+		_commands.setUniform(modelLocation, objects[_index].getModel());
+		occlusionQueries.recordDrawBegin(_index, _commands);
+		objects[_index].Record(_commands, _shader, true, _view, &visibleMeshes[_index]);
+		occlusionQueries.recordDrawEnd(_index, _commands);
+	});
+
+	if (!_view.gpuOcclusion)
+	{
+		commandRecorder.replay();
+		return;
+	}
+
+	// the same commands are replayed twice: the early phase draws what last frame's depth didn't hide, the late
+	// phase only the indirect draws that show up against the depth the early phase left
+	std::vector<IndirectDraw> draws;
+	commandRecorder.gatherIndirectDraws(draws);
+	occlusionCuller.setDraws(draws);
+	occlusionCuller.cull(false);
+	_shader.use();
+	commandRecorder.replay();
+
+	occlusionCuller.buildPyramid(_view.viewProjection);
+	occlusionCuller.cull(true);
+	_shader.use();
+	commandRecorder.replay(true);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
 void renderSkybox(Skybox _skybox,Shader _shader) 
 {
 	_shader.use();
 	glm::mat4 view = glm::mat4(glm::mat3(camera.GetViewMatrix())); // remove translation from the view matrix
-	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+	glm::mat4 projection = getCameraProjection();
 	_shader.setMat4("view", view);
 	_shader.setMat4("projection", projection);
 	_skybox.draw(_skybox.dayCubemapTexture);
@@ -336,6 +917,127 @@ void processInput(GLFWwindow *window)
 		MoveLightKeypressed = false;
 	}
 
+	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !PlaceLightKeyPressed) {
+		PlaceLightKeyPressed = true;
+		placeLight(camera.position);
+	}
+	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
+	{
+		PlaceLightKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !ClearLightsKeyPressed) {
+		ClearLightsKeyPressed = true;
+		lights.clear();
+	}
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+	{
+		ClearLightsKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && !ProfilerKeyPressed) {
+		ProfilerKeyPressed = true;
+		profiler.setEnabled(!profiler.isEnabled());
+	}
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
+	{
+		ProfilerKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !OcclusionKeyPressed) {
+		OcclusionKeyPressed = true;
+		occlusionCuller.setEnabled(!occlusionCuller.isEnabled());
+	}
+	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+	{
+		OcclusionKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS && !QueriesKeyPressed) {
+		QueriesKeyPressed = true;
+		occlusionQueries.setEnabled(!occlusionQueries.isEnabled());
+	}
+	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_RELEASE)
+	{
+		QueriesKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !SoftwareOcclusionKeyPressed) {
+		SoftwareOcclusionKeyPressed = true;
+		softwareOcclusion.setEnabled(!softwareOcclusion.isEnabled());
+	}
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE)
+	{
+		SoftwareOcclusionKeyPressed = false;
+	}
+
+	// shadow quality tiers: T doubles the resolution up to 4096 and wraps to 256, F steps through the depth formats
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !ShadowResolutionKeyPressed) {
+		ShadowResolutionKeyPressed = true;
+		unsigned int resolution = shadowFBO.resolution * 2;
+		shadowFBO.setQuality(resolution > ShadowFBO::maxResolution ? ShadowFBO::minResolution : resolution, shadowFBO.depthFormat);
+	}
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
+	{
+		ShadowResolutionKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && !ShadowFormatKeyPressed) {
+		ShadowFormatKeyPressed = true;
+		const GLenum formats[] = { GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT32F };
+		unsigned int current = 0;
+		while (current < 2 && formats[current] != shadowFBO.depthFormat)
+			current++;
+		shadowFBO.setQuality(shadowFBO.resolution, formats[(current + 1) % 3]);
+	}
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_RELEASE)
+	{
+		ShadowFormatKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && !ShadowFilterKeyPressed) {
+		ShadowFilterKeyPressed = true;
+		shadowFilter = (shadowFilter + 1) % ShadowFilterCount;
+	}
+	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_RELEASE)
+	{
+		ShadowFilterKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !ShadowAtlasKeyPressed) {
+		ShadowAtlasKeyPressed = true;
+		useShadowAtlas = !useShadowAtlas;
+		shadowStorageSwitched = true;
+	}
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+	{
+		ShadowAtlasKeyPressed = false;
+	}
+
+	// K steps the placed lights through automatic, cube and dual paraboloid shadows, B benchmarks the last two
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && !ShadowProjectionKeyPressed) {
+		ShadowProjectionKeyPressed = true;
+		placedLightProjection = (ShadowProjection)(((int)placedLightProjection + 1) % 3);
+		for (PointLight &light : lights)
+			light.shadowProjection = placedLightProjection;
+	}
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_RELEASE)
+	{
+		ShadowProjectionKeyPressed = false;
+	}
+
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !ShadowBenchmarkKeyPressed) {
+		ShadowBenchmarkKeyPressed = true;
+		if (!useShadowAtlas)
+			std::cout << "SHADOWBENCHMARK:: runs on the shadow atlas, switch to it with G" << std::endl;
+		else if (!shadowBenchmark.isRunning())
+			shadowBenchmark.start();
+	}
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_RELEASE)
+	{
+		ShadowBenchmarkKeyPressed = false;
+	}
+
 	if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS && !displayDepthKeyPressed)
 	{
 		displayDepth = !displayDepth;
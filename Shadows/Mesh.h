@@ -6,10 +6,16 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "CommandBuffer.h"
+#include "VertexPacking.h"
+#include "Culling.h"
+#include "Profiler.h"
 
 #include <string>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 using namespace std;
 
 struct Vertex {
@@ -25,6 +31,25 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
+// a small run of triangles that is culled on its own, see buildMeshlets
+struct Meshlet {
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	// bounding sphere, mesh space
+	glm::vec3 center;
+	float radius;
+	// normal cone, the cutoff is 1 when the triangles face too many ways for the cone to ever cull
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+// one level of detail: its meshlets and how far its surface may be from the full resolution one
+struct MeshLod {
+	unsigned int firstMeshlet;
+	unsigned int meshletCount;
+	float error;	// mesh units
+};
+
 struct Texture {
 	unsigned int id;
 	string type;
@@ -37,9 +62,28 @@ public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	vector<string> samplerNames;	// sampler uniform for each texture (texture_diffuseN, texture_specularN, ...)
+	vector<Meshlet> meshlets;		// contiguous index ranges covering the index buffer in order, filled in by Model
+	vector<MeshLod> lods;			// full resolution first, the simplified levels follow in the same index buffer
+	glm::vec3 diffuseColor = glm::vec3(1.0f);	// the material's colour, drawn instead of a texture when there is none
+	bool shadowOnly = false;		// no material, left out of the colour pass but still casts shadows
 	unsigned int VAO;
+	unsigned int depthVAO;	// position only stream for the shadow and depth passes
 	//unsigned int shadowMap
 
+	// bounds in mesh space, worked out when the mesh is set up
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 sphereCenter;
+	float sphereRadius;
+
+	// packed positions are normalised to the mesh bounds, the shaders rebuild them as offset + p * scale
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+
+	// 16 bit indices whenever the vertex count allows it, Model splits bigger meshes up
+	static const size_t maxShortIndexVertices = 65536;
+	IndexType indexType;
+
 	/*  Functions  */
 	// constructor
 	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
@@ -50,62 +94,182 @@ public:
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
+		setupSamplerNames();
 	}
 
-	//bindTextures
+	// records the mesh's draw into a command buffer. Uniform locations have to be cached in the shader
+	// beforehand since this may run on a worker thread. Meshlets the view can't see are left out.
+	void Record(CommandBuffer &commands, const Shader &shader, bool withTextures, const LocalCullView &view)
+	{
+		vector<unsigned char> masks;
+		if (shadowOnly || !selectMeshlets(view, masks))
+			return;
 
-	void DrawWithTextures(Shader shader, unsigned int _shadowCubemap = 0) {
+		commands.setUniform(shader.getCachedUniformLocation("positionOffset"), positionOffset);
+		commands.setUniform(shader.getCachedUniformLocation("positionScale"), positionScale);
 
-		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
+		if (withTextures)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-			// retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-			else if (name == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to stream
+			commands.setUniform(shader.getCachedUniformLocation("useMaterialColor"), (int)textures.empty());
+			commands.setUniform(shader.getCachedUniformLocation("materialColor"), diffuseColor);
+			for (unsigned int i = 0; i < textures.size(); i++)
+			{
+				commands.setUniform(shader.getCachedUniformLocation(samplerNames[i]), (int)i);
+				commands.bindTexture(i, TextureTarget::Texture2D, textures[i].id);
+			}
+		}
 
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		commands.bindVertexArray(VAO);
+		recordRanges(commands, shader, view, masks);
+	}
+
+	// records a depth only draw, fetching nothing but tightly packed positions
+	void RecordDepth(CommandBuffer &commands, const Shader &shader, const LocalCullView &view)
+	{
+		vector<unsigned char> masks;
+		if (!selectMeshlets(view, masks))
+			return;
+
+		commands.setUniform(shader.getCachedUniformLocation("positionOffset"), positionOffset);
+		commands.setUniform(shader.getCachedUniformLocation("positionScale"), positionScale);
+		commands.bindVertexArray(depthVAO);
+		recordRanges(commands, shader, view, masks);
+	}
+
+	// coarsest level whose error stays within what the view allows
+	unsigned int selectLod(float maxError) const
+	{
+		unsigned int lod = 0;
+		while (lod + 1 < lods.size() && lods[lod + 1].error <= maxError)
+			lod++;
+		return lod;
+	}
+
+	// culls the mesh and then the meshlets of the LOD the view asks for. masks gets the cube faces each meshlet
+	// has to be drawn to (all six for camera views), 0 for the culled ones.
+	bool selectMeshlets(const LocalCullView &view, vector<unsigned char> &masks) const
+	{
+		if (!view.boundsTested)
+		{
+			profiler.add(ProfileCounter::MeshesTested, 1);
+			if (!view.boundsVisible(boundsMin, boundsMax, sphereCenter, sphereRadius))
+			{
+				profiler.add(ProfileCounter::MeshesCulled, 1);
+				return false;
+			}
 		}
 
-		if (_shadowCubemap != 0)
+		unsigned int meshMask = view.boxFaceMask(boundsMin, boundsMax);
+		if (meshMask == 0)
+			return false;
+		if (lods.empty())
 		{
-			glActiveTexture(GL_TEXTURE0 + textures.size());
-			glBindTexture(GL_TEXTURE_CUBE_MAP, _shadowCubemap);
+			masks.push_back((unsigned char)meshMask);
+			return true;
 		}
 
-		Draw();
+		// faces only need testing per meshlet when the mesh as a whole spans several
+		bool testFaces = (meshMask & (meshMask - 1)) != 0;
+		const MeshLod &lod = lods[selectLod(view.lodError)];
+		unsigned int culled = 0;
+		masks.resize(lod.meshletCount);
+		for (unsigned int i = 0; i < lod.meshletCount; i++)
+		{
+			const Meshlet &meshlet = meshlets[lod.firstMeshlet + i];
+			unsigned int mask = 0;
+			if (view.sphereVisible(meshlet.center, meshlet.radius) &&
+				!view.coneBackfacing(meshlet.center, meshlet.radius, meshlet.coneAxis, meshlet.coneCutoff))
+				mask = testFaces ? meshMask & view.sphereFaceMask(meshlet.center, meshlet.radius) : meshMask;
+			masks[i] = (unsigned char)mask;
+			if (mask == 0)
+				culled++;
+		}
+		profiler.add(ProfileCounter::MeshletsTested, lod.meshletCount);
+		profiler.add(ProfileCounter::MeshletsCulled, culled);
+		return culled < lod.meshletCount;
 	}
 
-	// render the mesh
-	void Draw()
+private:
+	// one multi draw per distinct face mask, visible runs of meshlets merge into (index count, byte offset) ranges.
+	// Neighbouring meshlets are adjacent in the index buffer so most runs collapse into one range.
+	void recordRanges(CommandBuffer &commands, const Shader &shader, const LocalCullView &view, const vector<unsigned char> &masks)
 	{
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
-		glBindVertexArray(0);
+		int faceMaskLocation = shader.getCachedUniformLocation("faceMask");
+		if (lods.empty())
+		{
+			commands.setUniform(faceMaskLocation, (int)masks[0]);
+			if (view.gpuOcclusion)
+			{
+				IndirectDraw draw = { worldSphere(view, sphereCenter, sphereRadius), (unsigned int)indices.size(), 0, 0, 0 };
+				commands.multiDrawElementsIndirect(&draw, 1, indexType);
+			}
+			else
+				commands.drawElements((unsigned int)indices.size(), indexType, 0);
+			return;
+		}
+
+		size_t indexSize = indexType == IndexType::UInt16 ? sizeof(unsigned short) : sizeof(unsigned int);
+		const MeshLod &lod = lods[selectLod(view.lodError)];
+		bool drawn[64] = {};
+		vector<unsigned int> ranges;
+		vector<IndirectDraw> draws;
+		for (unsigned int first = 0; first < masks.size(); first++)
+		{
+			unsigned char mask = masks[first];
+			if (mask == 0 || drawn[mask])
+				continue;
+			drawn[mask] = true;
+
+			// the occlusion culler needs every meshlet's bounds, so nothing is merged
+			if (view.gpuOcclusion)
+			{
+				draws.clear();
+				for (unsigned int i = first; i < masks.size(); i++)
+				{
+					if (masks[i] != mask)
+						continue;
+					const Meshlet &meshlet = meshlets[lod.firstMeshlet + i];
+					draws.push_back({ worldSphere(view, meshlet.center, meshlet.radius), meshlet.indexCount, meshlet.firstIndex, 0, 0 });
+				}
+				commands.setUniform(faceMaskLocation, (int)mask);
+				commands.multiDrawElementsIndirect(&draws[0], (unsigned int)draws.size(), indexType);
+				continue;
+			}
+
+			ranges.clear();
+			unsigned int runStart = 0, runEnd = 0;
+			for (unsigned int i = first; i < masks.size(); i++)
+			{
+				if (masks[i] != mask)
+					continue;
+				const Meshlet &meshlet = meshlets[lod.firstMeshlet + i];
+				if (runEnd != meshlet.firstIndex)
+				{
+					if (runEnd > runStart)
+					{
+						ranges.push_back(runEnd - runStart);
+						ranges.push_back((unsigned int)(runStart * indexSize));
+					}
+					runStart = meshlet.firstIndex;
+				}
+				runEnd = meshlet.firstIndex + meshlet.indexCount;
+			}
+			ranges.push_back(runEnd - runStart);
+			ranges.push_back((unsigned int)(runStart * indexSize));
+
+			commands.setUniform(faceMaskLocation, (int)mask);
+			commands.multiDrawElements(&ranges[0], (unsigned int)ranges.size() / 2, indexType);
+		}
+	}
+
+	// mesh space bounding sphere moved into world space as (centre, radius)
+	static glm::vec4 worldSphere(const LocalCullView &view, glm::vec3 center, float radius)
+	{
+		return glm::vec4(glm::vec3(view.model * glm::vec4(center, 1.0f)), radius * view.maxScale);
 	}
 
-private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	unsigned int VBO, EBO, positionVBO;
 
 	/*  Functions    */
 	// initializes all the buffer objects/arrays
@@ -117,33 +281,109 @@ private:
 		glGenBuffers(1, &EBO);
 
 		glBindVertexArray(VAO);
+
+		// quantise the vertices, positions relative to the mesh bounds
+		computeBounds();
+		positionOffset = boundsMin;
+		positionScale = glm::max(boundsMax - boundsMin, glm::vec3(1.0e-6f));
+
+		vector<PackedVertex> packed(vertices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++)
+			packed[i] = packVertex(vertices[i].Position, vertices[i].Normal, vertices[i].TexCoords, vertices[i].Tangent, vertices[i].Bitangent,
+				positionOffset, positionScale);
+
 		// load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		if (vertices.size() <= maxShortIndexVertices)
+		{
+			// halves index memory and fetch bandwidth
+			indexType = IndexType::UInt16;
+			vector<unsigned short> shortIndices(indices.begin(), indices.end());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), &shortIndices[0], GL_STATIC_DRAW);
+		}
+		else
+		{
+			indexType = IndexType::UInt32;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		}
 
 		// set the vertex attribute pointers
-		// vertex Positions
+		setPackedVertexAttributes();
+
+		glBindVertexArray(0);
+
+		setupDepthStream(packed);
+	}
+
+	// box and a sphere around its centre, the sphere is sized by the vertices rather than the box corners
+	void computeBounds()
+	{
+		boundsMin = boundsMax = vertices[0].Position;
+		for (unsigned int i = 1; i < vertices.size(); i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[i].Position);
+			boundsMax = glm::max(boundsMax, vertices[i].Position);
+		}
+		sphereCenter = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (unsigned int i = 0; i < vertices.size(); i++)
+		{
+			glm::vec3 offset = vertices[i].Position - sphereCenter;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		sphereRadius = std::sqrt(radiusSquared);
+	}
+
+	// the depth shaders only read the position, so give them a separate vertex array over a buffer of
+	// just the packed positions (8 instead of 20 bytes per vertex) that shares the index buffer
+	void setupDepthStream(const vector<PackedVertex> &packed)
+	{
+		vector<unsigned short> positions(packed.size() * 4);
+		for (unsigned int i = 0; i < packed.size(); i++)
+			for (unsigned int j = 0; j < 4; j++)
+				positions[i * 4 + j] = packed[i].Position[j];
+
+		glGenVertexArrays(1, &depthVAO);
+		glGenBuffers(1, &positionVBO);
+
+		glBindVertexArray(depthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(unsigned short), &positions[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(unsigned short), (void*)0);
 
 		glBindVertexArray(0);
 	}
+
+	// works out the sampler name of each texture once instead of on every draw
+	void setupSamplerNames()
+	{
+		unsigned int diffuseNr = 1;
+		unsigned int specularNr = 1;
+		unsigned int normalNr = 1;
+		unsigned int heightNr = 1;
+		samplerNames.clear();
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			// retrieve texture number (the N in diffuse_textureN)
+			string number;
+			string name = textures[i].type;
+			if (name == "texture_diffuse")
+				number = std::to_string(diffuseNr++);
+			else if (name == "texture_specular")
+				number = std::to_string(specularNr++); // transfer unsigned int to stream
+			else if (name == "texture_normal")
+				number = std::to_string(normalNr++); // transfer unsigned int to stream
+			else if (name == "texture_height")
+				number = std::to_string(heightNr++); // transfer unsigned int to stream
+
+			samplerNames.push_back(name + number);
+		}
+	}
 };
\ No newline at end of file
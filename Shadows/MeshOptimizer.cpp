@@ -0,0 +1,607 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static size_t hashVertex(const Vertex &_vertex)
+{
+	// FNV-1a over the raw bytes, welding only merges bitwise identical vertices anyway
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&_vertex);
+	size_t hash = 2166136261u;
+	for (size_t i = 0; i < sizeof(Vertex); i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+void weldVertices(std::vector<Vertex> &_vertices, std::vector<unsigned int> &_indices)
+{
+	size_t tableSize = 1;
+	while (tableSize < _vertices.size() * 2)
+		tableSize *= 2;
+
+	// open addressing table of indices into the welded vertex list
+	std::vector<unsigned int> table(tableSize, ~0u);
+	std::vector<unsigned int> remap(_vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(_vertices.size());
+
+	for (size_t i = 0; i < _vertices.size(); i++)
+	{
+		size_t slot = hashVertex(_vertices[i]) & (tableSize - 1);
+		while (table[slot] != ~0u && std::memcmp(&welded[table[slot]], &_vertices[i], sizeof(Vertex)) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+
+		if (table[slot] == ~0u)
+		{
+			table[slot] = (unsigned int)welded.size();
+			welded.push_back(_vertices[i]);
+		}
+		remap[i] = table[slot];
+	}
+
+	for (size_t i = 0; i < _indices.size(); i++)
+		_indices[i] = remap[_indices[i]];
+	_vertices.swap(welded);
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &_indices, size_t _vertexCount)
+{
+	size_t triangleCount = _indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// vertex -> triangle adjacency
+	std::vector<unsigned int> liveTriangles(_vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		liveTriangles[_indices[i]]++;
+
+	std::vector<unsigned int> adjacencyOffsets(_vertexCount + 1, 0);
+	for (size_t i = 0; i < _vertexCount; i++)
+		adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacency[fill[_indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<unsigned int> cacheTime(_vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<unsigned int> deadEnds;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+
+	unsigned int time = vertexCacheSize + 1;
+	size_t cursor = 1;
+	long long fanning = 0;
+
+	while (fanning >= 0)
+	{
+		// emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (unsigned int i = adjacencyOffsets[fanning]; i < adjacencyOffsets[fanning + 1]; i++)
+		{
+			unsigned int triangle = adjacency[i];
+			if (emitted[triangle])
+				continue;
+
+			for (unsigned int j = 0; j < 3; j++)
+			{
+				unsigned int vertex = _indices[triangle * 3 + j];
+				result.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				if (time - cacheTime[vertex] > vertexCacheSize)
+					cacheTime[vertex] = time++;
+			}
+			emitted[triangle] = true;
+		}
+
+		// next fanning vertex: the candidate that stays in the cache longest and still has triangles left
+		long long next = -1;
+		int bestPriority = -1;
+		for (unsigned int vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+				continue;
+
+			int priority = 0;
+			if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= vertexCacheSize)
+				priority = time - cacheTime[vertex];
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = vertex;
+			}
+		}
+
+		// dead end, fall back to recently used vertices and then to the input order
+		while (next < 0 && !deadEnds.empty())
+		{
+			unsigned int vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0)
+				next = vertex;
+		}
+		while (next < 0 && cursor < _vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+				next = (long long)cursor;
+			cursor++;
+		}
+
+		fanning = next;
+	}
+
+	_indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<unsigned int> &_indices, const std::vector<Vertex> &_vertices)
+{
+	// clusters shorter than this aren't worth breaking the cache order for
+	const size_t minClusterTriangles = 64;
+
+	size_t triangleCount = _indices.size() / 3;
+	if (triangleCount < minClusterTriangles * 2)
+		return;
+
+	struct Cluster {
+		size_t first, count;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	std::vector<glm::vec3> centroids;	// area weighted
+	std::vector<glm::vec3> normals;		// sum of the area scaled triangle normals
+	std::vector<float> areas;
+
+	// walk the triangles through a simulated cache and start a new cluster where the cache starts over
+	std::vector<unsigned int> insertTime(_vertices.size(), 0);
+	std::vector<bool> cached(_vertices.size(), false);
+	unsigned int misses = 0;
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t i = 0; i < triangleCount; i++)
+	{
+		unsigned int triangleMisses = 0;
+		for (unsigned int j = 0; j < 3; j++)
+		{
+			unsigned int vertex = _indices[i * 3 + j];
+			if (!cached[vertex] || misses - insertTime[vertex] >= vertexCacheSize)
+			{
+				cached[vertex] = true;
+				insertTime[vertex] = misses++;
+				triangleMisses++;
+			}
+		}
+
+		if (clusters.empty() || (triangleMisses == 3 && clusters.back().count >= minClusterTriangles))
+		{
+			clusters.push_back({ i, 0, 0.0f });
+			centroids.push_back(glm::vec3(0.0f));
+			normals.push_back(glm::vec3(0.0f));
+			areas.push_back(0.0f);
+		}
+		clusters.back().count++;
+
+		glm::vec3 a = _vertices[_indices[i * 3]].Position;
+		glm::vec3 b = _vertices[_indices[i * 3 + 1]].Position;
+		glm::vec3 c = _vertices[_indices[i * 3 + 2]].Position;
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float area = glm::length(normal);
+		glm::vec3 centroid = (a + b + c) / 3.0f;
+
+		centroids.back() += centroid * area;
+		normals.back() += normal;
+		areas.back() += area;
+		meshCentroid += centroid * area;
+		meshArea += area;
+	}
+
+	if (clusters.size() < 2 || meshArea <= 0.0f)
+		return;
+	meshCentroid /= meshArea;
+
+	// clusters that sit on the outside of the mesh and face outwards go first. The normals are averaged over the
+	// cluster's area, so a curved cluster facing many ways counts for less than a flat one
+	for (size_t i = 0; i < clusters.size(); i++)
+	{
+		if (areas[i] <= 0.0f)
+			continue;
+		glm::vec3 centroid = centroids[i] / areas[i];
+		clusters[i].sortKey = glm::dot(centroid - meshCentroid, normals[i] / areas[i]);
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &_a, const Cluster &_b) { return _a.sortKey > _b.sortKey; });
+
+	std::vector<unsigned int> result;
+	result.reserve(_indices.size());
+	for (const Cluster &cluster : clusters)
+		result.insert(result.end(), _indices.begin() + cluster.first * 3, _indices.begin() + (cluster.first + cluster.count) * 3);
+	_indices.swap(result);
+}
+
+void optimizeVertexFetch(std::vector<Vertex> &_vertices, std::vector<unsigned int> &_indices)
+{
+	std::vector<unsigned int> remap(_vertices.size(), ~0u);
+	std::vector<Vertex> ordered;
+	ordered.reserve(_vertices.size());
+
+	for (size_t i = 0; i < _indices.size(); i++)
+	{
+		unsigned int &remapped = remap[_indices[i]];
+		if (remapped == ~0u)
+		{
+			remapped = (unsigned int)ordered.size();
+			ordered.push_back(_vertices[_indices[i]]);
+		}
+		_indices[i] = remapped;
+	}
+	_vertices.swap(ordered);
+}
+
+static Meshlet computeMeshletBounds(unsigned int _firstIndex, unsigned int _indexCount, const std::vector<Vertex> &_vertices,
+	const std::vector<unsigned int> &_indices)
+{
+	Meshlet meshlet;
+	meshlet.firstIndex = _firstIndex;
+	meshlet.indexCount = _indexCount;
+
+	// sphere around the box centre, not the tightest but cheap and good enough at this size
+	glm::vec3 boundsMin = _vertices[_indices[_firstIndex]].Position, boundsMax = boundsMin;
+	for (unsigned int i = _firstIndex; i < _firstIndex + _indexCount; i++)
+	{
+		boundsMin = glm::min(boundsMin, _vertices[_indices[i]].Position);
+		boundsMax = glm::max(boundsMax, _vertices[_indices[i]].Position);
+	}
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (unsigned int i = _firstIndex; i < _firstIndex + _indexCount; i++)
+	{
+		glm::vec3 offset = _vertices[_indices[i]].Position - meshlet.center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	meshlet.radius = std::sqrt(radiusSquared);
+
+	// the cone axis is the average face normal, its cutoff comes from the normal furthest away from it
+	std::vector<glm::vec3> normals;
+	glm::vec3 axis(0.0f);
+	for (unsigned int i = _firstIndex; i + 2 < _firstIndex + _indexCount; i += 3)
+	{
+		glm::vec3 a = _vertices[_indices[i]].Position;
+		glm::vec3 b = _vertices[_indices[i + 1]].Position;
+		glm::vec3 c = _vertices[_indices[i + 2]].Position;
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+			continue;
+		normals.push_back(normal / length);
+		axis += normal / length;
+	}
+
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 1.0f;
+	float axisLength = glm::length(axis);
+	if (axisLength <= 0.0f)
+		return meshlet;
+	axis /= axisLength;
+
+	float minDot = 1.0f;
+	for (const glm::vec3 &normal : normals)
+		minDot = std::min(minDot, glm::dot(normal, axis));
+
+	// cones wider than ~85 degrees are too wide to be worth testing
+	if (minDot > 0.1f)
+	{
+		meshlet.coneAxis = axis;
+		meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+	return meshlet;
+}
+
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &_vertices, const std::vector<unsigned int> &_indices)
+{
+	std::vector<Meshlet> meshlets;
+	if (_indices.size() < 3)
+		return meshlets;
+
+	// last meshlet each vertex was counted in
+	std::vector<unsigned int> lastMeshlet(_vertices.size(), ~0u);
+	unsigned int meshletIndex = 0, firstIndex = 0, vertexCount = 0;
+
+	for (unsigned int i = 0; i + 2 < _indices.size(); i += 3)
+	{
+		unsigned int newVertices = 0;
+		for (unsigned int j = i; j < i + 3; j++)
+			if (lastMeshlet[_indices[j]] != meshletIndex)
+				newVertices++;
+
+		if (vertexCount + newVertices > meshletMaxVertices || (i - firstIndex) / 3 >= meshletMaxTriangles)
+		{
+			meshlets.push_back(computeMeshletBounds(firstIndex, i - firstIndex, _vertices, _indices));
+			meshletIndex++;
+			firstIndex = i;
+			vertexCount = 0;
+		}
+
+		for (unsigned int j = i; j < i + 3; j++)
+		{
+			if (lastMeshlet[_indices[j]] != meshletIndex)
+			{
+				lastMeshlet[_indices[j]] = meshletIndex;
+				vertexCount++;
+			}
+		}
+	}
+	meshlets.push_back(computeMeshletBounds(firstIndex, (unsigned int)(_indices.size() / 3 * 3) - firstIndex, _vertices, _indices));
+
+	return meshlets;
+}
+
+static void addQuadric(double *_q, const double *_r)
+{
+	for (int i = 0; i < 11; i++)
+		_q[i] += _r[i];
+}
+
+static double evaluateQuadric(const double *_q, glm::vec3 _p)
+{
+	double x = _p.x, y = _p.y, z = _p.z;
+	double result = _q[0] * x * x + 2.0 * _q[1] * x * y + 2.0 * _q[2] * x * z + _q[3] * y * y + 2.0 * _q[4] * y * z + _q[5] * z * z
+		+ 2.0 * (_q[6] * x + _q[7] * y + _q[8] * z) + _q[9];
+	return result > 0.0 ? result : 0.0;
+}
+
+// how far apart two wedges are in attribute space
+static float attributeDistance(const Vertex &_a, const Vertex &_b)
+{
+	glm::vec3 normal = _a.Normal - _b.Normal;
+	glm::vec2 texCoords = _a.TexCoords - _b.TexCoords;
+	return glm::dot(normal, normal) + glm::dot(texCoords, texCoords);
+}
+
+MeshSimplifier::MeshSimplifier(const std::vector<Vertex> &_vertices, const std::vector<unsigned int> &_indices)
+	: vertices(_vertices), indices(_indices)
+{
+	// group the vertices by position
+	std::vector<unsigned int> order(vertices.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	auto lessPosition = [&](unsigned int _a, unsigned int _b) {
+		const glm::vec3 &a = vertices[_a].Position, &b = vertices[_b].Position;
+		return a.x != b.x ? a.x < b.x : (a.y != b.y ? a.y < b.y : a.z < b.z);
+	};
+	std::sort(order.begin(), order.end(), lessPosition);
+
+	group.resize(vertices.size());
+	groupVertices = order;
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		if (i == 0 || lessPosition(order[i - 1], order[i]))
+			groupOffsets.push_back(i);
+		group[order[i]] = (unsigned int)groupOffsets.size() - 1;
+	}
+	groupOffsets.push_back((unsigned int)order.size());
+	size_t groupCount = groupOffsets.size() - 1;
+
+	// plane quadrics of the original triangles
+	quadrics.assign(groupCount, Quadric());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		glm::vec3 a = vertices[indices[i]].Position;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+		double area = glm::length(normal);
+		if (area <= 0.0)
+			continue;
+		double nx = normal.x / area, ny = normal.y / area, nz = normal.z / area;
+		double d = -(nx * a.x + ny * a.y + nz * a.z);
+		double plane[11] = { nx * nx * area, nx * ny * area, nx * nz * area, ny * ny * area, ny * nz * area, nz * nz * area,
+			nx * d * area, ny * d * area, nz * d * area, d * d * area, area };
+		for (size_t j = i; j < i + 3; j++)
+			addQuadric(quadrics[group[indices[j]]].values, plane);
+	}
+
+	// lock groups on open or non-manifold edges so borders and silhouettes of open meshes stay put
+	std::vector<std::pair<unsigned int, unsigned int>> edges;
+	edges.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			unsigned int a = group[indices[i + j]], b = group[indices[i + (j + 1) % 3]];
+			edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	locked.assign(groupCount, false);
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+		if (j - i != 2)
+			locked[edges[i].first] = locked[edges[i].second] = true;
+		i = j;
+	}
+}
+
+bool MeshSimplifier::simplify(size_t _targetIndexCount, float _maxError)
+{
+	size_t startCount = indices.size();
+	while (indices.size() > _targetIndexCount)
+	{
+		if (collapsePass(_targetIndexCount, _maxError) == 0)
+			break;
+	}
+	return indices.size() < startCount;
+}
+
+size_t MeshSimplifier::collapsePass(size_t _targetIndexCount, float _maxError)
+{
+	size_t groupCount = quadrics.size();
+	size_t triangleCount = indices.size() / 3;
+
+	// group -> triangle adjacency
+	std::vector<unsigned int> adjacencyOffsets(groupCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacencyOffsets[group[indices[i]] + 1]++;
+	for (size_t i = 0; i < groupCount; i++)
+		adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacency[fill[group[indices[i]]]++] = (unsigned int)(i / 3);
+
+	// every edge in both directions, cost is the error of moving the first group onto the second
+	struct Collapse {
+		unsigned int from, to;
+		double cost;
+	};
+	std::vector<Collapse> collapses;
+	collapses.reserve(triangleCount * 6);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		unsigned int a = group[indices[i]], b = group[indices[i - i % 3 + (i + 1) % 3]];
+		for (int direction = 0; direction < 2; direction++)
+		{
+			unsigned int from = direction == 0 ? a : b, to = direction == 0 ? b : a;
+			if (locked[from])
+				continue;
+			Quadric sum = quadrics[from];
+			addQuadric(sum.values, quadrics[to].values);
+			double cost = sum.values[10] > 0.0 ? evaluateQuadric(sum.values, groupPosition(to)) / sum.values[10] : 0.0;
+			collapses.push_back({ from, to, cost });
+		}
+	}
+	std::sort(collapses.begin(), collapses.end(), [](const Collapse &_a, const Collapse &_b) { return _a.cost < _b.cost; });
+
+	std::vector<bool> touched(groupCount, false);
+	std::vector<unsigned int> remap(vertices.size(), ~0u);
+	std::vector<unsigned int> wedgeMap;
+	double maxCost = (double)_maxError * _maxError;
+	size_t removedTriangles = 0, collapsed = 0;
+
+	for (const Collapse &collapse : collapses)
+	{
+		if (collapse.cost > maxCost || (triangleCount - removedTriangles) * 3 <= _targetIndexCount)
+			break;
+		unsigned int from = collapse.from, to = collapse.to;
+		if (touched[from] || touched[to])
+			continue;
+
+		// map every wedge onto the closest wedge of the target. Seam vertices need the target to be split the same
+		// way and each side of the seam has to land on its own wedge, otherwise textures would smear across it
+		unsigned int fromWedges = groupOffsets[from + 1] - groupOffsets[from];
+		unsigned int toWedges = groupOffsets[to + 1] - groupOffsets[to];
+		if (fromWedges > 1 && fromWedges != toWedges)
+			continue;
+		wedgeMap.clear();
+		bool seamMatches = true;
+		for (unsigned int i = groupOffsets[from]; i < groupOffsets[from + 1]; i++)
+		{
+			unsigned int best = groupVertices[groupOffsets[to]];
+			float bestDistance = attributeDistance(vertices[groupVertices[i]], vertices[best]);
+			for (unsigned int j = groupOffsets[to] + 1; j < groupOffsets[to + 1]; j++)
+			{
+				float distance = attributeDistance(vertices[groupVertices[i]], vertices[groupVertices[j]]);
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = groupVertices[j];
+				}
+			}
+			if (fromWedges > 1 && std::find(wedgeMap.begin(), wedgeMap.end(), best) != wedgeMap.end())
+				seamMatches = false;
+			wedgeMap.push_back(best);
+		}
+		if (!seamMatches)
+			continue;
+
+		// reject the collapse if any remaining triangle around the group would flip or fold over
+		glm::vec3 target = groupPosition(to);
+		bool flips = false;
+		unsigned int sharedTriangles = 0;
+		for (unsigned int i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1] && !flips; i++)
+		{
+			unsigned int triangle = adjacency[i];
+			glm::vec3 before[3], after[3];
+			bool shared = false;
+			for (unsigned int j = 0; j < 3; j++)
+			{
+				unsigned int corner = group[indices[triangle * 3 + j]];
+				before[j] = after[j] = groupPosition(corner);
+				if (corner == from)
+					after[j] = target;
+				if (corner == to)
+					shared = true;
+			}
+			if (shared)
+			{
+				sharedTriangles++;
+				continue;
+			}
+			glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(normalBefore, normalAfter) < 0.25f * glm::length(normalBefore) * glm::length(normalAfter) || glm::length(normalAfter) <= 0.0f)
+				flips = true;
+		}
+		if (flips)
+			continue;
+
+		// commit, neighbours are frozen for the rest of the pass since their triangles just changed
+		for (unsigned int i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++)
+			for (unsigned int j = 0; j < 3; j++)
+				touched[group[indices[adjacency[i] * 3 + j]]] = true;
+		touched[to] = true;
+
+		for (unsigned int i = 0; i < fromWedges; i++)
+			remap[groupVertices[groupOffsets[from] + i]] = wedgeMap[i];
+		addQuadric(quadrics[to].values, quadrics[from].values);
+		error = std::max(error, (float)std::sqrt(collapse.cost));
+		removedTriangles += sharedTriangles;
+		collapsed++;
+	}
+
+	if (collapsed == 0)
+		return 0;
+
+	// rewrite the triangles and drop the ones that collapsed
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i < triangleCount; i++)
+	{
+		unsigned int corners[3];
+		for (unsigned int j = 0; j < 3; j++)
+		{
+			corners[j] = indices[i * 3 + j];
+			if (remap[corners[j]] != ~0u)
+				corners[j] = remap[corners[j]];
+		}
+		if (group[corners[0]] == group[corners[1]] || group[corners[1]] == group[corners[2]] || group[corners[0]] == group[corners[2]])
+			continue;
+		result.insert(result.end(), corners, corners + 3);
+	}
+	indices.swap(result);
+	return collapsed;
+}
+
+float computeACMR(const std::vector<unsigned int> &_indices, size_t _vertexCount)
+{
+	if (_indices.size() < 3)
+		return 0.0f;
+
+	std::vector<unsigned int> insertTime(_vertexCount, 0);
+	std::vector<bool> cached(_vertexCount, false);
+	unsigned int misses = 0;
+	for (size_t i = 0; i < _indices.size(); i++)
+	{
+		unsigned int vertex = _indices[i];
+		if (!cached[vertex] || misses - insertTime[vertex] >= vertexCacheSize)
+		{
+			cached[vertex] = true;
+			insertTime[vertex] = misses++;
+		}
+	}
+	return (float)misses / (float)(_indices.size() / 3);
+}
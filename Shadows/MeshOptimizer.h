@@ -0,0 +1,75 @@
+#ifndef _MESHOPTIMIZER_H_
+#define _MESHOPTIMIZER_H_
+
+#include "Mesh.h"
+
+#include <vector>
+
+// Import time processing of indexed triangle lists, run by Model on every mesh before it is uploaded.
+
+// post-transform vertex cache the reordering and the statistics assume (FIFO)
+const unsigned int vertexCacheSize = 16;
+
+// merges bitwise identical vertices and rewrites the indices to match
+void weldVertices(std::vector<Vertex> &_vertices, std::vector<unsigned int> &_indices);
+
+// reorders triangles for post-transform cache reuse (Tipsify, Sander et al. 2007)
+void optimizeVertexCache(std::vector<unsigned int> &_indices, size_t _vertexCount);
+
+// splits the cache optimised triangle order into clusters at cache restarts and sorts the clusters so the
+// outward facing ones are drawn first, which cuts overdraw without giving up much cache reuse
+void optimizeOverdraw(std::vector<unsigned int> &_indices, const std::vector<Vertex> &_vertices);
+
+// reorders the vertices by first use so fetches walk the vertex buffer linearly, unused vertices are dropped
+void optimizeVertexFetch(std::vector<Vertex> &_vertices, std::vector<unsigned int> &_indices);
+
+// limits a meshlet is cut at, small enough to cull finely, big enough that a visible run is still a decent draw
+const unsigned int meshletMaxVertices = 64;
+const unsigned int meshletMaxTriangles = 124;
+
+// cuts the (already optimised) triangle order into meshlets and works out their bounding spheres and normal
+// cones. The triangles aren't reordered, so meshlets are contiguous index ranges in index buffer order.
+std::vector<Meshlet> buildMeshlets(const std::vector<Vertex> &_vertices, const std::vector<unsigned int> &_indices);
+
+// Quadric error edge collapse simplifier (Garland & Heckbert). Vertices only ever collapse onto a neighbour,
+// so every vertex of a simplified level is an original one with its attributes intact. Open borders are locked,
+// vertices split by attribute seams only move along a matching seam and triangles that would flip are rejected.
+// Call simplify() with falling targets to build an LOD chain. A group's quadric takes in the quadrics of every
+// group collapsed onto it, so each collapse is measured against the original surface, never the level before,
+// and the error of a level is the largest single collapse so far, not a sum over the levels.
+class MeshSimplifier {
+public:
+	MeshSimplifier(const std::vector<Vertex> &_vertices, const std::vector<unsigned int> &_indices);
+
+	// collapses edges until at most _targetIndexCount indices are left or the next collapse would put the surface
+	// further than _maxError (mesh units) from the original. Returns false when nothing could be collapsed.
+	bool simplify(size_t _targetIndexCount, float _maxError);
+
+	const std::vector<unsigned int> &getIndices() const { return indices; }
+	// largest collapse cost so far over all calls, the area weighted root mean square distance of the moved
+	// vertices from the original planes they carry, mesh units. Never shrinks, so it fits LOD selection as it is
+	float getError() const { return error; }
+
+private:
+	// symmetric 4x4 error quadric, area weighted
+	struct Quadric {
+		double values[11];	// a00 a01 a02 a11 a12 a22 b0 b1 b2 c, then the summed area
+	};
+
+	const std::vector<Vertex> &vertices;
+	std::vector<unsigned int> indices;
+	// vertices sharing a position form a group, the groups are what collapses
+	std::vector<unsigned int> group;
+	std::vector<unsigned int> groupOffsets, groupVertices;
+	std::vector<Quadric> quadrics;
+	std::vector<bool> locked;
+	float error = 0.0f;
+
+	glm::vec3 groupPosition(unsigned int _group) const { return vertices[groupVertices[groupOffsets[_group]]].Position; }
+	size_t collapsePass(size_t _targetIndexCount, float _maxError);
+};
+
+// average cache misses per triangle for a FIFO cache of vertexCacheSize entries
+float computeACMR(const std::vector<unsigned int> &_indices, size_t _vertexCount);
+
+#endif
@@ -10,11 +10,13 @@
 #include <assimp/postprocess.h>
 
 #include "Mesh.h"
+#include "MeshOptimizer.h"
 #include "Shader.h"
 
 #include <string>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include "stb_image.h"
 #include "TransformComponent.h"
@@ -32,30 +34,86 @@ public:
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	// box and bounding sphere of all meshes, model space
+	glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
 
 	/*  Functions   */
-	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// constructor, expects a filepath to a 3D model. With mergeMaterials all submeshes sharing a material become
+	// one mesh, and submeshes without a material of their own are merged into a single mesh that only casts shadows.
+	Model(string const &path, bool gamma = false, bool mergeMaterials = true) : gammaCorrection(gamma), mergeMaterials(mergeMaterials)
 	{
 		loadModel(path);
 	}
 
-	// draws the model, and thus all its meshes
-	void DrawWithTextures(Shader shader, unsigned int _shaderCubemap = 0)
+	// records the model's draws into a command buffer, safe to call from worker threads. Meshlets
+	// outside the view or facing away from it are skipped. visibleMeshes limits the draw to meshes a BVH
+	// query already found in view, nullptr tests every mesh.
+	void Record(CommandBuffer &commands, const Shader &shader, bool withTextures, const CullView &view, const vector<unsigned int> *visibleMeshes = nullptr)
 	{
-		for (unsigned int i = 0; i < meshes.size(); i++) 
-			meshes[i].DrawWithTextures(shader, _shaderCubemap);
-		
+		LocalCullView localView(view, getModel(), boundsCenter, boundsRadius);
+		localView.boundsTested = visibleMeshes != nullptr;
+		unsigned int count = visibleMeshes ? (unsigned int)visibleMeshes->size() : (unsigned int)meshes.size();
+		for (unsigned int i = 0; i < count; i++)
+			meshes[visibleMeshes ? (*visibleMeshes)[i] : i].Record(commands, shader, withTextures, localView);
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw()
+	// records depth only draws using the meshes' position streams
+	void RecordDepth(CommandBuffer &commands, const Shader &shader, const CullView &view, const vector<unsigned int> *visibleMeshes = nullptr)
 	{
+		LocalCullView localView(view, getModel(), boundsCenter, boundsRadius);
+		localView.boundsTested = visibleMeshes != nullptr;
+		unsigned int count = visibleMeshes ? (unsigned int)visibleMeshes->size() : (unsigned int)meshes.size();
+		for (unsigned int i = 0; i < count; i++)
+			meshes[visibleMeshes ? (*visibleMeshes)[i] : i].RecordDepth(commands, shader, localView);
+	}
+
+	// heavy models can have their bounding box tested with an occlusion query before they're drawn
+	void setOcclusionQuery(bool enabled) { occlusionQuery = enabled; }
+	bool getOcclusionQuery() { return occlusionQuery; }
+	// big static models can hide others, their full resolution level goes into the CPU occlusion buffer
+	void setOccluder(bool enabled) { occluder = enabled; }
+	bool getOccluder() { return occluder; }
+	// scales the views' contribution culling threshold for this model, 0 keeps important props however small
+	void setContributionScale(float scale) { contributionScale = scale; }
+	float getContributionScale() { return contributionScale; }
+
+	// sampler uniforms used by the meshes, for Shader::cacheUniformLocations
+	vector<string> getSamplerNames()
+	{
+		vector<string> names;
 		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw();
+			names.insert(names.end(), meshes[i].samplerNames.begin(), meshes[i].samplerNames.end());
+		return names;
 	}
 
 private:
+	// an assimp mesh after extraction, before merging and optimisation
+	struct ImportedMesh {
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		vector<Texture> textures;
+		glm::vec3 diffuseColor;
+		unsigned int materialIndex;
+		bool hasMaterial;	// false for no material or assimp's default one
+	};
+
+	bool mergeMaterials;
+	bool occlusionQuery = false;
+	bool occluder = false;
+	float contributionScale = 1.0f;
+
+	// LOD chain: each level aims for half the triangles of the one before, no level may stray further from the
+	// original surface than this fraction of the mesh's radius (see MeshSimplifier::getError)
+	static const unsigned int maxLods = 4;
+	static const unsigned int minLodTriangles = 32;
+	static constexpr float maxLodError = 0.05f;
+
+	// totals over all meshes for the import report, cache misses are summed so they can be averaged per triangle
+	size_t importedVertices = 0, optimizedVertices = 0, triangleCount = 0;
+	float importedMisses = 0.0f, optimizedMisses = 0.0f;
+
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(string const &path)
@@ -73,11 +131,42 @@ private:
 		directory = path.substr(0, path.find_last_of('/'));
 
 		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		vector<ImportedMesh> imported;
+		processNode(scene->mRootNode, scene, imported);
+
+		// merge, optimise and upload
+		vector<ImportedMesh> merged = mergeMaterials ? mergeByMaterial(imported) : imported;
+		for (unsigned int i = 0; i < merged.size(); i++)
+		{
+			bool shadowOnly = mergeMaterials && !merged[i].hasMaterial;
+			optimizeMesh(merged[i].vertices, merged[i].indices);
+			addMeshChunks(merged[i].vertices, merged[i].indices, merged[i].textures, merged[i].diffuseColor, shadowOnly);
+		}
+		computeBounds();
+		cout << "MODEL::" << path << ": " << imported.size() << " submeshes -> " << meshes.size() << " meshes" << endl;
+
+		// report what the packed vertex layout saves over full floats (colour stream + position stream)
+		size_t vertexCount = 0, indexCount = 0, indexBytes = 0, meshletCount = 0, lodCount = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			meshletCount += meshes[i].meshlets.size();
+			lodCount += meshes[i].lods.size();
+			vertexCount += meshes[i].vertices.size();
+			indexCount += meshes[i].indices.size();
+			indexBytes += meshes[i].indices.size() * (meshes[i].indexType == IndexType::UInt16 ? sizeof(unsigned short) : sizeof(unsigned int));
+		}
+		cout << "MODEL::" << path << ": optimised " << importedVertices << " -> " << optimizedVertices << " vertices, ACMR "
+			<< importedMisses / std::max<size_t>(triangleCount, 1) << " -> " << optimizedMisses / std::max<size_t>(triangleCount, 1) << endl;
+		cout << "MODEL::" << path << ": " << meshes.size() << " meshes, " << vertexCount << " vertices, vertex memory "
+			<< vertexCount * (sizeof(Vertex) + sizeof(glm::vec3)) / 1024 << " KB as floats -> "
+			<< vertexCount * (sizeof(PackedVertex) + 4 * sizeof(unsigned short)) / 1024 << " KB packed ("
+			<< sizeof(Vertex) << " -> " << sizeof(PackedVertex) << " bytes per vertex), index memory "
+			<< indexCount * sizeof(unsigned int) / 1024 << " KB as 32 bit -> " << indexBytes / 1024 << " KB (all LODs), " << meshletCount << " meshlets, "
+			<< (float)lodCount / std::max<size_t>(meshes.size(), 1) << " LODs per mesh" << endl;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	void processNode(aiNode *node, const aiScene *scene, vector<ImportedMesh> &imported)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -85,17 +174,18 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			imported.push_back(processMesh(mesh, scene));
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, imported);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// extracts the vertices, indices and material textures of an assimp mesh
+	ImportedMesh processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// data to fill
 		vector<Vertex> vertices;
@@ -150,7 +240,15 @@ private:
 				indices.push_back(face.mIndices[j]);
 		}
 		// process materials
+		if (mesh->mMaterialIndex >= scene->mNumMaterials)
+			return { vertices, indices, textures, glm::vec3(1.0f), mesh->mMaterialIndex, false };
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		// untextured materials are drawn in their diffuse colour
+		aiColor3D diffuseColor(1.0f, 1.0f, 1.0f);
+		material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
+		aiString materialName;
+		material->Get(AI_MATKEY_NAME, materialName);
+		bool hasMaterial = materialName != aiString(AI_DEFAULT_MATERIAL_NAME);
 		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
 		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
 		// Same applies to other texture as the following list summarizes:
@@ -171,8 +269,177 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		return { vertices, indices, textures, glm::vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b), mesh->mMaterialIndex, hasMaterial };
+	}
+
+	// concatenates submeshes with the same material, the ones without a material all go into one
+	vector<ImportedMesh> mergeByMaterial(const vector<ImportedMesh> &imported)
+	{
+		vector<ImportedMesh> merged;
+		for (unsigned int i = 0; i < imported.size(); i++)
+		{
+			int target = -1;
+			for (unsigned int j = 0; j < merged.size() && target < 0; j++)
+			{
+				if (merged[j].hasMaterial != imported[i].hasMaterial)
+					continue;
+				if (!imported[i].hasMaterial || merged[j].materialIndex == imported[i].materialIndex)
+					target = (int)j;
+			}
+
+			if (target < 0)
+			{
+				merged.push_back(imported[i]);
+				continue;
+			}
+
+			ImportedMesh &mesh = merged[target];
+			unsigned int base = (unsigned int)mesh.vertices.size();
+			mesh.vertices.insert(mesh.vertices.end(), imported[i].vertices.begin(), imported[i].vertices.end());
+			for (unsigned int j = 0; j < imported[i].indices.size(); j++)
+				mesh.indices.push_back(imported[i].indices[j] + base);
+		}
+		return merged;
+	}
+
+	// import time optimisation: weld identical vertices, reorder triangles for the vertex cache and then for
+	// overdraw, and finally reorder the vertices for fetch locality
+	void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices)
+	{
+		size_t triangles = indices.size() / 3;
+		importedVertices += vertices.size();
+		importedMisses += computeACMR(indices, vertices.size()) * triangles;
+
+		weldVertices(vertices, indices);
+		optimizeVertexCache(indices, vertices.size());
+		optimizeOverdraw(indices, vertices);
+		optimizeVertexFetch(vertices, indices);
+
+		optimizedVertices += vertices.size();
+		optimizedMisses += computeACMR(indices, vertices.size()) * triangles;
+		triangleCount += triangles;
+	}
+
+	// adds the mesh, split into chunks of at most Mesh::maxShortIndexVertices vertices so every chunk can use
+	// 16 bit indices
+	void addMeshChunks(const vector<Vertex> &vertices, const vector<unsigned int> &indices, const vector<Texture> &textures,
+		glm::vec3 diffuseColor, bool shadowOnly)
+	{
+		if (vertices.size() <= Mesh::maxShortIndexVertices)
+		{
+			addMesh(vertices, indices, textures, diffuseColor, shadowOnly);
+			return;
+		}
+
+		vector<int> remap(vertices.size(), -1);
+		vector<unsigned int> used;
+		vector<Vertex> chunkVertices;
+		vector<unsigned int> chunkIndices;
+
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			unsigned int newVertices = 0;
+			for (size_t j = i; j < i + 3; j++)
+				if (remap[indices[j]] < 0)
+					newVertices++;
+
+			// flush the chunk when this triangle wouldn't fit anymore
+			if (chunkVertices.size() + newVertices > Mesh::maxShortIndexVertices)
+			{
+				addMesh(chunkVertices, chunkIndices, textures, diffuseColor, shadowOnly);
+				for (unsigned int j = 0; j < used.size(); j++)
+					remap[used[j]] = -1;
+				used.clear();
+				chunkVertices.clear();
+				chunkIndices.clear();
+			}
+
+			for (size_t j = i; j < i + 3; j++)
+			{
+				if (remap[indices[j]] < 0)
+				{
+					remap[indices[j]] = (int)chunkVertices.size();
+					chunkVertices.push_back(vertices[indices[j]]);
+					used.push_back(indices[j]);
+				}
+				chunkIndices.push_back(remap[indices[j]]);
+			}
+		}
+
+		if (!chunkIndices.empty())
+			addMesh(chunkVertices, chunkIndices, textures, diffuseColor, shadowOnly);
+	}
+
+	// builds the LOD chain and the meshlets of every level, the levels share the vertices and are appended to
+	// the index buffer one after the other
+	void addMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, const vector<Texture> &textures,
+		glm::vec3 diffuseColor, bool shadowOnly)
+	{
+		vector<unsigned int> allIndices;
+		vector<Meshlet> meshlets;
+		vector<MeshLod> lods;
+		appendLod(vertices, indices, 0.0f, allIndices, meshlets, lods);
+
+		// the radius puts the error limit in proportion, LODs further off than that aren't worth keeping
+		glm::vec3 boundsMin(vertices[0].Position), boundsMax(vertices[0].Position);
+		for (unsigned int i = 1; i < vertices.size(); i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[i].Position);
+			boundsMax = glm::max(boundsMax, vertices[i].Position);
+		}
+		float maxError = glm::length(boundsMax - boundsMin) * 0.5f * maxLodError;
+
+		MeshSimplifier simplifier(vertices, indices);
+		size_t targetIndexCount = indices.size();
+		for (unsigned int level = 1; level < maxLods; level++)
+		{
+			targetIndexCount = targetIndexCount / 2 / 3 * 3;
+			size_t previousCount = simplifier.getIndices().size();
+			if (targetIndexCount < minLodTriangles * 3 || !simplifier.simplify(targetIndexCount, maxError))
+				break;
+			// stop once a level hardly saves anything over the previous one
+			if (simplifier.getIndices().size() > previousCount * 3 / 4)
+				break;
+
+			vector<unsigned int> lodIndices = simplifier.getIndices();
+			optimizeVertexCache(lodIndices, vertices.size());
+			appendLod(vertices, lodIndices, simplifier.getError(), allIndices, meshlets, lods);
+		}
+
+		meshes.push_back(Mesh(vertices, allIndices, textures));
+		meshes.back().meshlets = meshlets;
+		meshes.back().lods = lods;
+		meshes.back().diffuseColor = diffuseColor;
+		meshes.back().shadowOnly = shadowOnly;
+	}
+
+	void appendLod(const vector<Vertex> &vertices, const vector<unsigned int> &lodIndices, float error,
+		vector<unsigned int> &allIndices, vector<Meshlet> &meshlets, vector<MeshLod> &lods)
+	{
+		vector<Meshlet> lodMeshlets = buildMeshlets(vertices, lodIndices);
+		for (unsigned int i = 0; i < lodMeshlets.size(); i++)
+			lodMeshlets[i].firstIndex += (unsigned int)allIndices.size();
+		lods.push_back({ (unsigned int)meshlets.size(), (unsigned int)lodMeshlets.size(), error });
+		meshlets.insert(meshlets.end(), lodMeshlets.begin(), lodMeshlets.end());
+		allIndices.insert(allIndices.end(), lodIndices.begin(), lodIndices.end());
+	}
+
+	// bounding sphere around the box of all meshes
+	void computeBounds()
+	{
+		if (meshes.empty())
+			return;
+		boundsMin = boundsMax = meshes[0].vertices[0].Position;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			for (unsigned int j = 0; j < meshes[i].vertices.size(); j++)
+			{
+				boundsMin = glm::min(boundsMin, meshes[i].vertices[j].Position);
+				boundsMax = glm::max(boundsMax, meshes[i].vertices[j].Position);
+			}
+		}
+		boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		boundsRadius = glm::length(boundsMax - boundsMin) * 0.5f;
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
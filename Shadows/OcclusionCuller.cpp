@@ -0,0 +1,191 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <iostream>
+
+void OcclusionCuller::configure(unsigned int _width, unsigned int _height)
+{
+	supported = GLAD_GL_VERSION_4_3 != 0;
+	if (!supported)
+	{
+		std::cout << "OCCLUSIONCULLER:: needs OpenGL 4.3, GPU occlusion culling is off" << std::endl;
+		return;
+	}
+
+	width = _width;
+	height = _height;
+
+	// colour only gets blitted to the screen, depth is a texture so the pyramid can read it
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR::OCCLUSIONCULLER:: framebuffer is not complete, GPU occlusion culling is off" << std::endl;
+		supported = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!supported)
+		return;
+
+	// full resolution first level, then halving down to 1x1
+	pyramidLevels = 1;
+	while ((std::max(width, height) >> pyramidLevels) > 0)
+		pyramidLevels++;
+	glGenTextures(1, &pyramidTexture);
+	glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+	glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	pyramidShader.reset(new Shader("Shaders/depthPyramid.comp"));
+	pyramidShader->use();
+	pyramidShader->setInt("sourceDepth", textureUnit);
+	pyramidShader->setInt("destination", 0);
+
+	cullShader.reset(new Shader("Shaders/occlusionCull.comp"));
+	cullShader->use();
+	cullShader->setInt("depthPyramid", textureUnit);
+	cullShader->setInt("pyramidLevels", pyramidLevels);
+	cullShader->setIVec2("pyramidSize", width, height);
+	glUseProgram(0);
+
+	glGenBuffers(1, &drawBuffer);
+	glGenBuffers(1, &earlyCommandBuffer);
+	glGenBuffers(1, &lateCommandBuffer);
+	glGenBuffers(1, &groupCountBuffer);
+	glGenBuffers(1, &earlyVisibleBuffer);
+	reserveDraws(1024);
+
+	enabled = true;
+}
+
+void OcclusionCuller::setEnabled(bool _enabled)
+{
+	if (_enabled && !supported)
+		return;
+	if (_enabled && !enabled)
+		hasPyramid = false;
+	enabled = _enabled;
+}
+
+void OcclusionCuller::bindFramebuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+}
+
+void OcclusionCuller::setDraws(const std::vector<IndirectDraw> &_draws)
+{
+	drawCount = (unsigned int)_draws.size();
+	reserveDraws(drawCount);
+	if (drawCount == 0)
+		return;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, drawCount * sizeof(IndirectDraw), &_draws[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void OcclusionCuller::cull(bool _latePhase)
+{
+	unsigned int commandBuffer = _latePhase ? lateCommandBuffer : earlyCommandBuffer;
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if (drawCount == 0)
+		return;
+
+	// zeroed commands draw nothing, the visible ones of each multi draw get packed to its front
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, drawCount * indirectCommandSize, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, groupCountBuffer);
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, drawCount * sizeof(unsigned int), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, groupCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, earlyVisibleBuffer);
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+	glActiveTexture(GL_TEXTURE0);
+
+	cullShader->use();
+	cullShader->setInt("drawCount", drawCount);
+	cullShader->setBool("latePhase", _latePhase);
+	cullShader->setBool("hasPyramid", hasPyramid);
+	cullShader->setMat4("viewProjection", pyramidViewProjection);
+	glDispatchCompute((drawCount + 63) / 64, 1, 1);
+
+	// the draws read the commands, the late phase reads what the early one marked visible
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void OcclusionCuller::buildPyramid(const glm::mat4 &_viewProjection)
+{
+	pyramidShader->use();
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+
+	// first level straight from the depth buffer, every other from the level above
+	unsigned int sourceWidth = width, sourceHeight = height;
+	for (unsigned int level = 0; level < pyramidLevels; level++)
+	{
+		unsigned int levelWidth = std::max(1u, width >> level);
+		unsigned int levelHeight = std::max(1u, height >> level);
+
+		glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+		pyramidShader->setInt("sourceLevel", level == 0 ? 0 : level - 1);
+		pyramidShader->setIVec2("sourceSize", sourceWidth, sourceHeight);
+		pyramidShader->setIVec2("destinationSize", levelWidth, levelHeight);
+		glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		sourceWidth = levelWidth;
+		sourceHeight = levelHeight;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	pyramidViewProjection = _viewProjection;
+	hasPyramid = true;
+}
+
+void OcclusionCuller::present()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void OcclusionCuller::reserveDraws(unsigned int _count)
+{
+	if (_count <= drawCapacity)
+		return;
+	drawCapacity = std::max(_count, drawCapacity * 2);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, drawCapacity * sizeof(IndirectDraw), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, earlyCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, drawCapacity * indirectCommandSize, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lateCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, drawCapacity * indirectCommandSize, NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, groupCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, drawCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, earlyVisibleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, drawCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
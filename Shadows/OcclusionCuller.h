@@ -0,0 +1,68 @@
+#ifndef _OCCLUSIONCULLER_H_
+#define _OCCLUSIONCULLER_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "CommandBuffer.h"
+
+#include <memory>
+#include <vector>
+
+// Two phase GPU occlusion culling for the camera pass. The pass renders into an offscreen framebuffer whose depth
+// is reduced into a max depth pyramid. Early phase: the recorded meshlet draws are tested against the pyramid of
+// the previous frame and the visible ones drawn. The pyramid is then rebuilt from that depth and the late phase
+// retests only what the early phase rejected, drawing whatever became visible. The tests run in a compute shader
+// that writes the indirect commands directly, nothing is read back.
+// Needs GL 4.3 (compute shaders, storage buffers, multi draw indirect), without it the pass draws as before.
+class OcclusionCuller {
+public:
+	// texture unit the depth pyramid is read from, kept clear of the material textures
+	static const unsigned int textureUnit = 11;
+
+	// checks the context version and creates the framebuffer, the pyramid and the culling programs
+	void configure(unsigned int _width, unsigned int _height);
+
+	bool isSupported() const { return supported; }
+	bool isEnabled() const { return enabled; }
+	// turning it back on starts over without a pyramid, last one is out of date
+	void setEnabled(bool _enabled);
+
+	// the camera pass renders here while culling is on
+	void bindFramebuffer();
+	// uploads the draws gathered from the recorded pass, in replay order
+	void setDraws(const std::vector<IndirectDraw> &_draws);
+	// fills the early or late indirect commands and binds them to GL_DRAW_INDIRECT_BUFFER
+	void cull(bool _latePhase);
+	// reduces the framebuffer's depth into the pyramid, _viewProjection is what it was rendered with
+	void buildPyramid(const glm::mat4 &_viewProjection);
+	// copies the colour to the default framebuffer
+	void present();
+
+private:
+	bool supported = false;
+	bool enabled = false;
+	bool hasPyramid = false;
+
+	unsigned int width = 0, height = 0;
+	unsigned int FBO;
+	unsigned int colorBuffer;
+	unsigned int depthTexture;
+	unsigned int pyramidTexture;
+	unsigned int pyramidLevels = 0;
+	glm::mat4 pyramidViewProjection = glm::mat4(1.0f);
+
+	std::unique_ptr<Shader> pyramidShader;
+	std::unique_ptr<Shader> cullShader;
+
+	// storage buffers, all sized for drawCapacity draws
+	unsigned int drawBuffer, earlyCommandBuffer, lateCommandBuffer, groupCountBuffer, earlyVisibleBuffer;
+	unsigned int drawCount = 0;
+	unsigned int drawCapacity = 0;
+
+	void reserveDraws(unsigned int _count);
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include "OcclusionQueries.h"
+
+#include "Profiler.h"
+
+void OcclusionQueries::configure()
+{
+	// unit box as 36 packed positions, placed with positionOffset/positionScale like a quantised mesh
+	static const unsigned short corners[8][3] = {
+		{ 0, 0, 0 }, { 65535, 0, 0 }, { 65535, 65535, 0 }, { 0, 65535, 0 },
+		{ 0, 0, 65535 }, { 65535, 0, 65535 }, { 65535, 65535, 65535 }, { 0, 65535, 65535 }
+	};
+	static const unsigned int faces[36] = {
+		0, 2, 1, 0, 3, 2,	4, 5, 6, 4, 6, 7,
+		0, 1, 5, 0, 5, 4,	3, 6, 2, 3, 7, 6,
+		0, 4, 7, 0, 7, 3,	1, 2, 6, 1, 6, 5
+	};
+	std::vector<unsigned short> positions;
+	for (unsigned int i = 0; i < 36; i++)
+	{
+		positions.insert(positions.end(), corners[faces[i]], corners[faces[i]] + 3);
+		positions.push_back(0);
+	}
+
+	glGenVertexArrays(1, &boxVAO);
+	glGenBuffers(1, &boxVBO);
+	glBindVertexArray(boxVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(unsigned short), &positions[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, 4 * sizeof(unsigned short), (void*)0);
+	glBindVertexArray(0);
+}
+
+void OcclusionQueries::setEnabled(bool _enabled)
+{
+	if (_enabled && !enabled)
+		for (QueryState &state : states)
+			state.visible = true;
+	enabled = _enabled;
+}
+
+void OcclusionQueries::beginFrame(unsigned int _objectCount)
+{
+	if (states.size() < _objectCount)
+		states.resize(_objectCount);
+	for (QueryState &state : states)
+		state.conditional = false;
+}
+
+void OcclusionQueries::recordQuery(unsigned int _object, glm::vec3 _boxMin, glm::vec3 _boxMax, glm::vec3 _eye, CommandBuffer &_commands,
+	const Shader &_shader)
+{
+	QueryState &state = states[_object];
+	if (state.query == 0)
+		glGenQueries(1, &state.query);
+
+	// only read results the GPU already has, a stall here would cost more than the query saves
+	state.framesSinceResult++;
+	if (state.pending)
+	{
+		GLuint available = 0;
+		glGetQueryObjectuiv(state.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint samples = 0;
+			glGetQueryObjectuiv(state.query, GL_QUERY_RESULT, &samples);
+			state.visible = samples != 0;
+			state.pending = false;
+			state.framesSinceResult = 0;
+		}
+	}
+
+	// with the eye in the box the near plane cuts its front faces away and the query would miss it
+	glm::vec3 margin(0.25f);
+	if (glm::all(glm::greaterThan(_eye, _boxMin - margin)) && glm::all(glm::lessThan(_eye, _boxMax + margin)))
+	{
+		state.visible = true;
+		return;
+	}
+
+	if (!state.pending && (!state.visible || state.framesSinceResult >= visibleRequeryInterval))
+	{
+		_commands.setUniform(_shader.getCachedUniformLocation("positionOffset"), _boxMin);
+		_commands.setUniform(_shader.getCachedUniformLocation("positionScale"), glm::max(_boxMax - _boxMin, glm::vec3(1.0e-6f)));
+		_commands.bindVertexArray(boxVAO);
+		_commands.beginQuery(state.query);
+		_commands.drawArrays(0, 36);
+		_commands.endQuery();
+		state.pending = true;
+		profiler.add(ProfileCounter::OcclusionQueries, 1);
+	}
+
+	// hidden objects draw conditionally on the newest query, whether issued now or still in flight
+	state.conditional = !state.visible;
+	if (!state.visible)
+		profiler.add(ProfileCounter::ObjectsHidden, 1);
+}
+
+void OcclusionQueries::recordDrawBegin(unsigned int _object, CommandBuffer &_commands) const
+{
+	if (_object < states.size() && states[_object].conditional)
+		_commands.beginConditionalRender(states[_object].query);
+}
+
+void OcclusionQueries::recordDrawEnd(unsigned int _object, CommandBuffer &_commands) const
+{
+	if (_object < states.size() && states[_object].conditional)
+		_commands.endConditionalRender();
+}
@@ -0,0 +1,53 @@
+#ifndef _OCCLUSIONQUERIES_H_
+#define _OCCLUSIONQUERIES_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "CommandBuffer.h"
+
+#include <vector>
+
+// Hardware occlusion queries for heavy objects. After a depth only pass of the big occluders, each object's
+// bounding box is drawn into a query and the object's own draws are made conditional on it. Results are only
+// picked up once the GPU has them, never waited on: an object keeps its last known visibility until then, hidden
+// objects are queried every frame and visible ones again every few frames.
+class OcclusionQueries {
+public:
+	// frames a visible object is drawn before its box is queried again
+	static const unsigned int visibleRequeryInterval = 8;
+
+	void configure();
+
+	bool isEnabled() const { return enabled; }
+	// turning it back on forgets what was hidden, those results are out of date
+	void setEnabled(bool _enabled);
+
+	// resets the per frame decisions, call before any recordQuery
+	void beginFrame(unsigned int _objectCount);
+	// collects the object's finished query and records a new box query if it needs one, GL thread only. _boxMin and
+	// _boxMax are the world space bounds, the shader takes packed positions like the depth passes.
+	void recordQuery(unsigned int _object, glm::vec3 _boxMin, glm::vec3 _boxMax, glm::vec3 _eye, CommandBuffer &_commands,
+		const Shader &_shader);
+
+	// wrap the object's draws, conditional on its query while it's thought to be hidden. Safe from worker threads.
+	void recordDrawBegin(unsigned int _object, CommandBuffer &_commands) const;
+	void recordDrawEnd(unsigned int _object, CommandBuffer &_commands) const;
+
+private:
+	struct QueryState {
+		unsigned int query = 0;
+		bool pending = false;			// issued, result not read yet
+		bool visible = true;			// last result that came back
+		bool conditional = false;		// this frame's draws go through conditional render
+		unsigned int framesSinceResult = visibleRequeryInterval;	// new objects are queried straight away
+	};
+
+	bool enabled = true;
+	std::vector<QueryState> states;
+	unsigned int boxVAO, boxVBO;
+};
+
+#endif
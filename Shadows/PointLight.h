@@ -0,0 +1,44 @@
+#ifndef _POINTLIGHT_H_
+#define _POINTLIGHT_H_
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// how a clustered light's shadow is stored in the shadow atlas. Automatic leaves it to the atlas, which gives lights
+// with small tiles the dual paraboloid: two passes instead of six, but the room's walls cast nothing into it and
+// large casters' shadows bend, see ShadowAtlas
+enum class ShadowProjection { Automatic, Cube, DualParaboloid };
+
+struct PointLight {
+	glm::vec3 position = glm::vec3(0.0f);
+
+	glm::vec3 ambient = glm::vec3(0.0f);
+	glm::vec3 diffuse = glm::vec3(1.0f);
+	glm::vec3 specular = glm::vec3(1.0f);
+
+	float constant = 1.0f;
+	float linear = 0.045f;
+	float quadratic = 0.0075f;
+
+	ShadowProjection shadowProjection = ShadowProjection::Automatic;
+
+	// distance at which the attenuated light drops below _threshold of its brightest channel.
+	// solves constant + linear * d + quadratic * d^2 = brightness / _threshold for d
+	float getRadius(float _threshold) const
+	{
+		float brightness = std::max(std::max(diffuse.r, diffuse.g), diffuse.b);
+		brightness = std::max(brightness, std::max(std::max(specular.r, specular.g), specular.b));
+		float c = constant - brightness / _threshold;
+		if (c >= 0.0f)
+			return 0.0f;
+
+		if (quadratic <= 0.0f)
+			return linear > 0.0f ? -c / linear : 1.0e6f;
+
+		return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+	}
+};
+
+#endif
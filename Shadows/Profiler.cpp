@@ -0,0 +1,59 @@
+#include "Profiler.h"
+
+#include <iostream>
+
+Profiler profiler;
+
+static const char *counterNames[] = {
+	"meshes tested",
+	"meshes culled",
+	"meshlets tested",
+	"meshlets culled",
+	"occlusion queries",
+	"objects hidden",
+	"meshes occluded",
+	"meshes too small",
+	"shadow pass GPU us",
+	"shadow slots drawn",
+	"of them dual paraboloids",
+	"cube shadows GPU us",
+	"dual paraboloid shadows GPU us"
+};
+
+Profiler::Profiler()
+{
+	for (unsigned int i = 0; i < counterCount; i++)
+	{
+		counters[i] = 0;
+		lastFrame[i] = 0;
+		totals[i] = 0;
+	}
+}
+
+void Profiler::endFrame(float _time)
+{
+	for (unsigned int i = 0; i < counterCount; i++)
+	{
+		lastFrame[i] = counters[i].exchange(0);
+		totals[i] += lastFrame[i];
+	}
+	frames++;
+
+	if (reportStart < 0.0f)
+		reportStart = _time;
+	if (_time - reportStart < reportInterval)
+		return;
+
+	if (enabled)
+	{
+		std::cout << "PROFILER:: " << frames / (_time - reportStart) << " fps";
+		for (unsigned int i = 0; i < counterCount; i++)
+			std::cout << ", " << counterNames[i] << " " << totals[i] / frames;
+		std::cout << " (per frame)" << std::endl;
+	}
+
+	for (unsigned int i = 0; i < counterCount; i++)
+		totals[i] = 0;
+	frames = 0;
+	reportStart = _time;
+}
@@ -0,0 +1,54 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <atomic>
+#include <string>
+
+// Per frame counters, safe to bump from the recording threads. While enabled the averages are printed
+// every couple of seconds.
+enum class ProfileCounter : unsigned int {
+	MeshesTested,
+	MeshesCulled,
+	MeshletsTested,
+	MeshletsCulled,
+	OcclusionQueries,
+	ObjectsHidden,
+	MeshesOccluded,
+	MeshesTooSmall,
+	ShadowPassMicroseconds,
+	ShadowSlotsDrawn,
+	ParaboloidShadowsDrawn,
+	CubeShadowMicroseconds,
+	ParaboloidShadowMicroseconds,
+	Count
+};
+
+class Profiler {
+public:
+	Profiler();
+
+	void add(ProfileCounter _counter, unsigned int _value) { counters[(unsigned int)_counter] += _value; }
+	// closes the frame, _time in seconds
+	void endFrame(float _time);
+
+	void setEnabled(bool _enabled) { enabled = _enabled; }
+	bool isEnabled() const { return enabled; }
+
+	// value the last finished frame ended with
+	unsigned int getLastFrame(ProfileCounter _counter) const { return lastFrame[(unsigned int)_counter]; }
+
+private:
+	static const unsigned int counterCount = (unsigned int)ProfileCounter::Count;
+	const float reportInterval = 2.0f;
+
+	std::atomic<unsigned int> counters[counterCount];
+	unsigned int lastFrame[counterCount];
+	unsigned long long totals[counterCount];
+	unsigned int frames = 0;
+	float reportStart = -1.0f;
+	bool enabled = false;
+};
+
+extern Profiler profiler;
+
+#endif
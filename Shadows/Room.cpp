@@ -1,69 +1,75 @@
 #include "Room.h"
+#include "StaticBatch.h"
+#include "SoftwareOcclusion.h"
+
+static const float cubings[] = {
+	// positions          // normals           // texture coords
+	//Front
+	-1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
+	 1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 5.0f, // top-right
+	 1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 0.0f, // bottom-right         
+	 1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 5.0f, // top-right
+	-1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
+	-1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 5.0f, // top-left
+	// Back Wall
+	-1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
+	 1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
+	 1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
+	 1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
+	-1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
+	-1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
+	// Right Wall
+	 1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
+	 1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
+	 1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
+	 1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
+	 1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
+	 1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
+	// Left wall
+	-1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
+	-1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
+	-1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
+	-1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
+	-1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
+	-1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
+	// Ceiling face
+	-1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
+	 1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
+	 1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
+	 1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
+	-1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
+	-1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
+	// Floor face
+	-1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
+	 1.0f, -1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
+	 1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
+	 1.0f, -1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
+	-1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
+	-1.0f, -1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left   
+};
 
 Room::Room() {
 
-	float cubings[] = {
-		// positions          // normals           // texture coords
-		//Front
-		-1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-		 1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 5.0f, // top-right
-		 1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 0.0f, // bottom-right         
-		 1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 5.0f, 5.0f, // top-right
-		-1.0f, -1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 0.0f, // bottom-left
-		-1.0f,  1.0f,  1.0f,  0.0f,  0.0f, -1.0f, 0.0f, 5.0f, // top-left
-		// Back Wall
-		-1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-		 1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 0.0f, // bottom-right
-		 1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-		 1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 1.0f, 1.0f, // top-right
-		-1.0f,  1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 1.0f, // top-left
-		-1.0f, -1.0f, -1.0f,  0.0f,  0.0f,  1.0f, 0.0f, 0.0f, // bottom-left
-		// Right Wall
-		 1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-		 1.0f,  1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-left
-		 1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-		 1.0f, -1.0f, -1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-left
-		 1.0f, -1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-		 1.0f,  1.0f,  1.0f, -1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-right
-		// Left wall
-		-1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-		-1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-		-1.0f,  1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 1.0f, // top-right         
-		-1.0f, -1.0f, -1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 1.0f, // bottom-right
-		-1.0f,  1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 1.0f, 0.0f, // top-left
-		-1.0f, -1.0f,  1.0f,  1.0f,  0.0f,  0.0f, 0.0f, 0.0f, // bottom-left     
-		// Ceiling face
-		-1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-		 1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 1.0f, // top-left
-		 1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-		 1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 1.0f, 0.0f, // bottom-left
-		-1.0f,  1.0f,  1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 0.0f, // bottom-right
-		-1.0f,  1.0f, -1.0f,  0.0f, -1.0f,  0.0f, 0.0f, 1.0f, // top-right
-		// Floor face
-		-1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-		 1.0f, -1.0f , 1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-		 1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 1.0f, // top-right     
-		 1.0f, -1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 1.0f, 0.0f, // bottom-right
-		-1.0f, -1.0f, -1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 1.0f, // top-left
-		-1.0f, -1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left   
-	};
+	// pack into the same vertex format the models use so one shader draws both
+	std::vector<PackedVertex> packed;
+	for (unsigned int i = 0; i < 36; i++)
+	{
+		const float *vertex = &cubings[i * 8];
+		glm::vec3 normal(vertex[3], vertex[4], vertex[5]);
+		glm::vec3 tangent = perpendicular(normal);
+		packed.push_back(packVertex(glm::vec3(vertex[0], vertex[1], vertex[2]), normal, glm::vec2(vertex[6], vertex[7]),
+			tangent, glm::cross(normal, tangent), positionOffset, positionScale));
+	}
 
 	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubings), cubings, GL_STATIC_DRAW);
-
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// normal attribute
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	// texture attribute
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
+
+	// position, normal, texture and tangent attributes
+	setPackedVertexAttributes();
 
 	//unbind
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -71,67 +77,65 @@ Room::Room() {
 
 };
 
-void Room::draw()
+void Room::record(CommandBuffer &_commands, const Shader &_shader, bool _withTextures)
 {
-	// render cube
-	glBindVertexArray(VAO);
-	glDrawArrays(GL_TRIANGLES, 0, 36);
-
-	//unbind
-	glBindVertexArray(0);
-	glActiveTexture(GL_TEXTURE0);
-}
-
-void Room::bindTextures(unsigned int _shadowCubemap)
-{
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textures[0]);
-
-		glActiveTexture(GL_TEXTURE0 + 1);
-		glBindTexture(GL_TEXTURE_2D, textures[1]);
-
-		glActiveTexture(GL_TEXTURE0 + 2);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, _shadowCubemap);
-
-		drawWalls();
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textures[2]);
+	_commands.setUniform(_shader.getCachedUniformLocation("positionOffset"), positionOffset);
+	_commands.setUniform(_shader.getCachedUniformLocation("positionScale"), positionScale);
+	_commands.bindVertexArray(VAO);
+	if (!_withTextures)
+	{
+		_commands.drawArrays(0, 36);
+		return;
+	}
 
-		//glActiveTexture(GL_TEXTURE0 + 1);
-		//glBindTexture(GL_TEXTURE_2D, textures[3]);
+	// walls
+	_commands.setUniform(_shader.getCachedUniformLocation("useMaterialColor"), 0);
+	_commands.bindTexture(0, TextureTarget::Texture2D, textures[0]);
+	_commands.bindTexture(1, TextureTarget::Texture2D, textures[1]);
+	_commands.drawArrays(0, 24);
 
-		glActiveTexture(GL_TEXTURE0 + 1);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, _shadowCubemap);
+	// floor and ceiling
+	_commands.bindTexture(0, TextureTarget::Texture2D, textures[2]);
+	_commands.drawArrays(24, 12);
+}
 
-		drawFloorCeiling();
 
-}
 
-void Room::drawFloorCeiling()
+void Room::addToBatch(StaticBatch &_batch)
 {
-	// render one face
-	glBindVertexArray(VAO);
-	glDrawArrays(GL_TRIANGLES, 24, 12);
+	// walls use the wallpaper's diffuse and specular maps, floor and ceiling the third texture
+	std::vector<Texture> wallTextures = { { textures[0], "texture_diffuse", "" }, { textures[1], "texture_specular", "" } };
+	std::vector<Texture> floorTextures = { { textures[2], "texture_diffuse", "" } };
 
-	//unbind
-	glBindVertexArray(0);
-	glActiveTexture(GL_TEXTURE0);
+	std::vector<Vertex> vertices;
+	for (unsigned int i = 0; i < 36; i++)
+	{
+		const float *vertex = &cubings[i * 8];
+		Vertex unpacked;
+		unpacked.Position = glm::vec3(vertex[0], vertex[1], vertex[2]);
+		unpacked.Normal = glm::vec3(vertex[3], vertex[4], vertex[5]);
+		unpacked.TexCoords = glm::vec2(vertex[6], vertex[7]);
+		unpacked.Tangent = perpendicular(unpacked.Normal);
+		unpacked.Bitangent = glm::cross(unpacked.Normal, unpacked.Tangent);
+		vertices.push_back(unpacked);
+
+		if (i == 23)
+		{
+			_batch.addTriangles(vertices, wallTextures, getModel(), true);
+			vertices.clear();
+		}
+	}
+	_batch.addTriangles(vertices, floorTextures, getModel(), true);
 }
-void Room::drawWalls() 
-{
-	// render cube
-	glBindVertexArray(VAO);
-	glDrawArrays(GL_TRIANGLES, 0, 24);
 
-	//unbind texture
-	//dont unbind vao as it will be used to draw ceiling and floor
-	glBindVertexArray(0);
-	glActiveTexture(GL_TEXTURE0);
+void Room::addToOcclusion(SoftwareOcclusion &_occlusion)
+{
+	std::vector<glm::vec3> positions;
+	for (unsigned int i = 0; i < 36; i++)
+		positions.push_back(glm::vec3(getModel() * glm::vec4(cubings[i * 8], cubings[i * 8 + 1], cubings[i * 8 + 2], 1.0f)));
+	_occlusion.addTriangles(positions);
 }
 
-
-
 void Room::loadTexture(char const * path)
 {
 	unsigned int textureID;
@@ -9,11 +9,16 @@
 #include "stb_image.h"
 
 #include "TransformComponent.h"
+#include "CommandBuffer.h"
+#include "VertexPacking.h"
+#include "Shader.h"
 
 #include <iostream>
 #include <vector>
 
 class Transform;
+class StaticBatch;
+class SoftwareOcclusion;
 
 class Room : public Transform{
 public:
@@ -22,14 +27,19 @@ public:
 
 	Room();
 	void loadTexture(char const * path);
-	void draw();
 
-	void bindTextures(unsigned int _shadowCubemap);
-	void drawFloorCeiling();
-	void drawWalls();
+	// records the walls, floor and ceiling into a command buffer, textured or depth only
+	void record(CommandBuffer &_commands, const Shader &_shader, bool _withTextures);
+	// bakes the walls, floor and ceiling into the static batch, needs the three textures loaded
+	void addToBatch(StaticBatch &_batch);
+	// the walls, floor and ceiling as world space occluders for the CPU culling
+	void addToOcclusion(SoftwareOcclusion &_occlusion);
 	
 private:
 	unsigned int VBO;
+	// the unit cube is packed like the model meshes, normalised to [-1, 1]
+	glm::vec3 positionOffset = glm::vec3(-1.0f);
+	glm::vec3 positionScale = glm::vec3(2.0f);
 	std::vector<unsigned int> textures;
 };
 
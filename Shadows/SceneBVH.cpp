@@ -0,0 +1,402 @@
+#include "SceneBVH.h"
+
+#include <algorithm>
+#include <limits>
+
+static const unsigned int binCount = 12;
+static const unsigned int maxLeafItems = 2;
+// relative cost of visiting a node against testing an item
+static const float traversalCost = 1.0f;
+static const float intersectionCost = 1.0f;
+
+static float surfaceArea(glm::vec3 _boundsMin, glm::vec3 _boundsMax)
+{
+	glm::vec3 size = glm::max(_boundsMax - _boundsMin, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+SceneBVH::~SceneBVH()
+{
+	if (rebuild.valid())
+		rebuild.wait();
+}
+
+void SceneBVH::build(const std::vector<BVHItem> &_items)
+{
+	if (rebuild.valid())
+		rebuild.wait();
+	rebuild = std::future<Tree>();
+
+	items = _items;
+	moved.assign(items.size(), false);
+	anyMoved = false;
+	Tree tree = buildTree(items);
+	adoptTree(tree);
+}
+
+void SceneBVH::updateItem(unsigned int _item, glm::vec3 _boundsMin, glm::vec3 _boundsMax)
+{
+	items[_item].boundsMin = _boundsMin;
+	items[_item].boundsMax = _boundsMax;
+	moved[_item] = true;
+	anyMoved = true;
+}
+
+void SceneBVH::refit()
+{
+	// a finished rebuild replaces the tree, it was built from older boxes so everything gets refitted
+	if (rebuild.valid() && rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		Tree tree = rebuild.get();
+		adoptTree(tree);
+		refitAll();
+		return;
+	}
+
+	if (!anyMoved || nodes.empty())
+		return;
+
+	// walk up from every moved item to the root
+	for (unsigned int i = 0; i < items.size(); i++)
+	{
+		if (!moved[i])
+			continue;
+		moved[i] = false;
+
+		unsigned int node = itemLeaf[i];
+		while (node != ~0u)
+		{
+			Node &current = nodes[node];
+			if (current.itemCount > 0)
+			{
+				current.boundsMin = items[itemOrder[current.firstItem]].boundsMin;
+				current.boundsMax = items[itemOrder[current.firstItem]].boundsMax;
+				for (unsigned int j = current.firstItem + 1; j < current.firstItem + current.itemCount; j++)
+				{
+					current.boundsMin = glm::min(current.boundsMin, items[itemOrder[j]].boundsMin);
+					current.boundsMax = glm::max(current.boundsMax, items[itemOrder[j]].boundsMax);
+				}
+			}
+			else
+			{
+				current.boundsMin = glm::min(nodes[current.left].boundsMin, nodes[current.left + 1].boundsMin);
+				current.boundsMax = glm::max(nodes[current.left].boundsMax, nodes[current.left + 1].boundsMax);
+			}
+			node = current.parent;
+		}
+	}
+	anyMoved = false;
+
+	cost = computeCost(nodes);
+	if (!rebuild.valid() && cost > builtCost * rebuildThreshold)
+		rebuild = std::async(std::launch::async, &SceneBVH::buildTree, items);
+}
+
+void SceneBVH::queryFrustum(const SimdFrustum &_frustum, std::vector<unsigned int> &_result) const
+{
+	if (nodes.empty())
+		return;
+
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty())
+	{
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!_frustum.intersectsBox((node.boundsMin + node.boundsMax) * 0.5f, (node.boundsMax - node.boundsMin) * 0.5f))
+			continue;
+
+		if (node.itemCount > 0)
+		{
+			for (unsigned int i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+			{
+				const BVHItem &item = items[itemOrder[i]];
+				if (node.itemCount == 1 || _frustum.intersectsBox((item.boundsMin + item.boundsMax) * 0.5f, (item.boundsMax - item.boundsMin) * 0.5f))
+					_result.push_back(itemOrder[i]);
+			}
+			continue;
+		}
+		stack.push_back(node.left);
+		stack.push_back(node.left + 1);
+	}
+}
+
+void SceneBVH::querySphere(glm::vec3 _center, float _radius, std::vector<unsigned int> &_result) const
+{
+	if (nodes.empty())
+		return;
+
+	// squared distance from the centre to the closest point of the box
+	auto touches = [&](glm::vec3 _boundsMin, glm::vec3 _boundsMax) {
+		glm::vec3 offset = glm::clamp(_center, _boundsMin, _boundsMax) - _center;
+		return glm::dot(offset, offset) <= _radius * _radius;
+	};
+
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty())
+	{
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+		if (!touches(node.boundsMin, node.boundsMax))
+			continue;
+
+		if (node.itemCount > 0)
+		{
+			for (unsigned int i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+				if (touches(items[itemOrder[i]].boundsMin, items[itemOrder[i]].boundsMax))
+					_result.push_back(itemOrder[i]);
+			continue;
+		}
+		stack.push_back(node.left);
+		stack.push_back(node.left + 1);
+	}
+}
+
+int SceneBVH::raycast(glm::vec3 _origin, glm::vec3 _direction, float _maxDistance, float &_distance) const
+{
+	if (nodes.empty())
+		return -1;
+
+	glm::vec3 inverseDirection = 1.0f / _direction;
+	// slab test, returns the entry distance or infinity on a miss. An axis the ray runs parallel to has no entry or
+	// exit, the origin is either between the slab's planes or the ray misses; dividing would give 0 * inf there
+	auto intersect = [&](glm::vec3 _boundsMin, glm::vec3 _boundsMax, float _limit) {
+		float enter = 0.0f, exit = _limit;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (_direction[axis] == 0.0f)
+			{
+				if (_origin[axis] < _boundsMin[axis] || _origin[axis] > _boundsMax[axis])
+					return std::numeric_limits<float>::infinity();
+				continue;
+			}
+			float t0 = (_boundsMin[axis] - _origin[axis]) * inverseDirection[axis];
+			float t1 = (_boundsMax[axis] - _origin[axis]) * inverseDirection[axis];
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+	};
+
+	int hit = -1;
+	_distance = _maxDistance;
+	std::vector<unsigned int> stack(1, 0);
+	while (!stack.empty())
+	{
+		const Node &node = nodes[stack.back()];
+		stack.pop_back();
+		if (intersect(node.boundsMin, node.boundsMax, _distance) > _distance)
+			continue;
+
+		if (node.itemCount > 0)
+		{
+			for (unsigned int i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+			{
+				float distance = intersect(items[itemOrder[i]].boundsMin, items[itemOrder[i]].boundsMax, _distance);
+				if (distance <= _distance)
+				{
+					_distance = distance;
+					hit = (int)itemOrder[i];
+				}
+			}
+			continue;
+		}
+
+		// push the far child first so the near one is visited first and shrinks the search
+		const Node &left = nodes[node.left], &right = nodes[node.left + 1];
+		float leftDistance = intersect(left.boundsMin, left.boundsMax, _distance);
+		float rightDistance = intersect(right.boundsMin, right.boundsMax, _distance);
+		if (leftDistance < rightDistance)
+		{
+			stack.push_back(node.left + 1);
+			stack.push_back(node.left);
+		}
+		else
+		{
+			stack.push_back(node.left);
+			stack.push_back(node.left + 1);
+		}
+	}
+	return hit;
+}
+
+SceneBVH::Tree SceneBVH::buildTree(std::vector<BVHItem> _items)
+{
+	Tree tree;
+	if (_items.empty())
+		return tree;
+
+	tree.itemOrder.resize(_items.size());
+	for (unsigned int i = 0; i < _items.size(); i++)
+		tree.itemOrder[i] = i;
+
+	Node root;
+	root.firstItem = 0;
+	root.itemCount = (unsigned int)_items.size();
+	root.left = 0;
+	root.parent = ~0u;
+	tree.nodes.reserve(_items.size() * 2);
+	tree.nodes.push_back(root);
+	splitNode(tree, _items, 0);
+	tree.cost = computeCost(tree.nodes);
+	return tree;
+}
+
+void SceneBVH::splitNode(Tree &_tree, const std::vector<BVHItem> &_items, unsigned int _node)
+{
+	Node &node = _tree.nodes[_node];
+	unsigned int first = node.firstItem, count = node.itemCount;
+
+	node.boundsMin = _items[_tree.itemOrder[first]].boundsMin;
+	node.boundsMax = _items[_tree.itemOrder[first]].boundsMax;
+	glm::vec3 centroidMin((_items[_tree.itemOrder[first]].boundsMin + _items[_tree.itemOrder[first]].boundsMax) * 0.5f), centroidMax(centroidMin);
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const BVHItem &item = _items[_tree.itemOrder[i]];
+		node.boundsMin = glm::min(node.boundsMin, item.boundsMin);
+		node.boundsMax = glm::max(node.boundsMax, item.boundsMax);
+		centroidMin = glm::min(centroidMin, (item.boundsMin + item.boundsMax) * 0.5f);
+		centroidMax = glm::max(centroidMax, (item.boundsMin + item.boundsMax) * 0.5f);
+	}
+	if (count <= maxLeafItems)
+		return;
+
+	glm::vec3 extent = centroidMax - centroidMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (extent[axis] <= 0.0f)
+		return;
+
+	// bin the centroids along the widest axis
+	struct Bin {
+		glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+		unsigned int count = 0;
+	};
+	Bin bins[binCount];
+	float binScale = binCount / extent[axis];
+	auto binOf = [&](const BVHItem &_item) {
+		float centroid = (_item.boundsMin[axis] + _item.boundsMax[axis]) * 0.5f;
+		return std::min((unsigned int)((centroid - centroidMin[axis]) * binScale), binCount - 1);
+	};
+	for (unsigned int i = first; i < first + count; i++)
+	{
+		const BVHItem &item = _items[_tree.itemOrder[i]];
+		Bin &bin = bins[binOf(item)];
+		bin.boundsMin = glm::min(bin.boundsMin, item.boundsMin);
+		bin.boundsMax = glm::max(bin.boundsMax, item.boundsMax);
+		bin.count++;
+	}
+
+	// sweep from the right to get the cost of each of the binCount - 1 split planes
+	float rightArea[binCount];
+	unsigned int rightCount[binCount];
+	Bin right;
+	for (unsigned int i = binCount - 1; i > 0; i--)
+	{
+		right.boundsMin = glm::min(right.boundsMin, bins[i].boundsMin);
+		right.boundsMax = glm::max(right.boundsMax, bins[i].boundsMax);
+		right.count += bins[i].count;
+		rightArea[i] = right.count > 0 ? surfaceArea(right.boundsMin, right.boundsMax) : 0.0f;
+		rightCount[i] = right.count;
+	}
+
+	float bestCost = std::numeric_limits<float>::max();
+	unsigned int bestSplit = 0;
+	Bin left;
+	for (unsigned int i = 0; i + 1 < binCount; i++)
+	{
+		left.boundsMin = glm::min(left.boundsMin, bins[i].boundsMin);
+		left.boundsMax = glm::max(left.boundsMax, bins[i].boundsMax);
+		left.count += bins[i].count;
+		if (left.count == 0 || rightCount[i + 1] == 0)
+			continue;
+		float splitCost = surfaceArea(left.boundsMin, left.boundsMax) * left.count + rightArea[i + 1] * rightCount[i + 1];
+		if (splitCost < bestCost)
+		{
+			bestCost = splitCost;
+			bestSplit = i + 1;
+		}
+	}
+
+	// keep the leaf when splitting doesn't pay for the extra node
+	float nodeArea = surfaceArea(node.boundsMin, node.boundsMax);
+	float leafCost = intersectionCost * count;
+	if (bestSplit == 0 || traversalCost + intersectionCost * bestCost / std::max(nodeArea, 1.0e-12f) >= leafCost)
+		return;
+
+	unsigned int *begin = &_tree.itemOrder[first];
+	unsigned int *middle = std::partition(begin, begin + count, [&](unsigned int _item) { return binOf(_items[_item]) < bestSplit; });
+	unsigned int leftCount = (unsigned int)(middle - begin);
+
+	unsigned int children = (unsigned int)_tree.nodes.size();
+	Node child;
+	child.left = 0;
+	child.parent = _node;
+	child.firstItem = first;
+	child.itemCount = leftCount;
+	_tree.nodes.push_back(child);
+	child.firstItem = first + leftCount;
+	child.itemCount = count - leftCount;
+	_tree.nodes.push_back(child);
+
+	// push_back may have moved the nodes
+	_tree.nodes[_node].left = children;
+	_tree.nodes[_node].itemCount = 0;
+
+	splitNode(_tree, _items, children);
+	splitNode(_tree, _items, children + 1);
+}
+
+float SceneBVH::computeCost(const std::vector<Node> &_nodes)
+{
+	if (_nodes.empty())
+		return 0.0f;
+
+	float rootArea = std::max(surfaceArea(_nodes[0].boundsMin, _nodes[0].boundsMax), 1.0e-12f);
+	float total = 0.0f;
+	for (const Node &node : _nodes)
+	{
+		float area = surfaceArea(node.boundsMin, node.boundsMax) / rootArea;
+		total += node.itemCount > 0 ? area * intersectionCost * node.itemCount : area * traversalCost;
+	}
+	return total;
+}
+
+void SceneBVH::adoptTree(Tree &_tree)
+{
+	nodes.swap(_tree.nodes);
+	itemOrder.swap(_tree.itemOrder);
+	builtCost = cost = _tree.cost;
+
+	itemLeaf.assign(items.size(), ~0u);
+	for (unsigned int i = 0; i < nodes.size(); i++)
+		for (unsigned int j = nodes[i].firstItem; j < nodes[i].firstItem + nodes[i].itemCount; j++)
+			itemLeaf[itemOrder[j]] = i;
+}
+
+void SceneBVH::refitAll()
+{
+	// children always come after their parent, so a reverse sweep sees them first
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		Node &node = nodes[i];
+		if (node.itemCount > 0)
+		{
+			node.boundsMin = items[itemOrder[node.firstItem]].boundsMin;
+			node.boundsMax = items[itemOrder[node.firstItem]].boundsMax;
+			for (unsigned int j = node.firstItem + 1; j < node.firstItem + node.itemCount; j++)
+			{
+				node.boundsMin = glm::min(node.boundsMin, items[itemOrder[j]].boundsMin);
+				node.boundsMax = glm::max(node.boundsMax, items[itemOrder[j]].boundsMax);
+			}
+		}
+		else
+		{
+			node.boundsMin = glm::min(nodes[node.left].boundsMin, nodes[node.left + 1].boundsMin);
+			node.boundsMax = glm::max(nodes[node.left].boundsMax, nodes[node.left + 1].boundsMax);
+		}
+	}
+	std::fill(moved.begin(), moved.end(), false);
+	anyMoved = false;
+	builtCost = computeCost(nodes);
+	cost = builtCost;
+}
@@ -0,0 +1,89 @@
+#ifndef _SCENEBVH_H_
+#define _SCENEBVH_H_
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+
+#include <future>
+#include <vector>
+
+// A bounding box in the BVH, tagged with what it belongs to (an object and one of its meshes)
+struct BVHItem {
+	glm::vec3 boundsMin, boundsMax;
+	unsigned int owner;
+	unsigned int mesh;
+};
+
+// Bounding volume hierarchy over world space boxes. Built with a binned surface area heuristic, refitted when
+// items move and rebuilt on a background thread once refitting has made the tree noticeably worse than a
+// fresh build would be.
+class SceneBVH {
+public:
+	~SceneBVH();
+
+	void build(const std::vector<BVHItem> &_items);
+
+	// moves an item, the tree catches up in refit()
+	void updateItem(unsigned int _item, glm::vec3 _boundsMin, glm::vec3 _boundsMax);
+	// refits the nodes above moved items, kicks off or collects a background rebuild. Once per frame.
+	void refit();
+
+	// items whose box touches the frustum / sphere, appended to _result
+	void queryFrustum(const SimdFrustum &_frustum, std::vector<unsigned int> &_result) const;
+	void querySphere(glm::vec3 _center, float _radius, std::vector<unsigned int> &_result) const;
+	// nearest item box along the ray within _maxDistance, -1 if none. _distance gets the hit distance.
+	int raycast(glm::vec3 _origin, glm::vec3 _direction, float _maxDistance, float &_distance) const;
+
+	// box around everything in the tree, false when it's empty
+	bool getBounds(glm::vec3 &_boundsMin, glm::vec3 &_boundsMax) const
+	{
+		if (nodes.empty())
+			return false;
+		_boundsMin = nodes[0].boundsMin;
+		_boundsMax = nodes[0].boundsMax;
+		return true;
+	}
+
+	const std::vector<BVHItem> &getItems() const { return items; }
+	size_t getNodeCount() const { return nodes.size(); }
+	float getCost() const { return cost; }
+
+private:
+	// leaves have itemCount > 0 and point into itemOrder, inner nodes have their children at left and left + 1
+	struct Node {
+		glm::vec3 boundsMin, boundsMax;
+		unsigned int left;
+		unsigned int firstItem;
+		unsigned int itemCount;
+		unsigned int parent;
+	};
+
+	struct Tree {
+		std::vector<Node> nodes;
+		std::vector<unsigned int> itemOrder;
+		float cost = 0.0f;
+	};
+
+	// rebuild once the refitted tree costs this much more than it did when it was built
+	const float rebuildThreshold = 1.3f;
+
+	std::vector<BVHItem> items;
+	std::vector<Node> nodes;
+	std::vector<unsigned int> itemOrder;
+	std::vector<unsigned int> itemLeaf;
+	std::vector<bool> moved;
+	bool anyMoved = false;
+	float builtCost = 0.0f;
+	float cost = 0.0f;
+
+	std::future<Tree> rebuild;
+
+	static Tree buildTree(std::vector<BVHItem> _items);
+	static void splitNode(Tree &_tree, const std::vector<BVHItem> &_items, unsigned int _node);
+	static float computeCost(const std::vector<Node> &_nodes);
+	void adoptTree(Tree &_tree);
+	void refitAll();
+};
+
+#endif
@@ -125,6 +125,54 @@ Shader::Shader(const GLchar* vertexShaderFilePath, const GLchar* fragmentShaderF
 	}
 }
 
+Shader::Shader(const GLchar* computeShaderFilePath) {
+
+	std::string computeCode;
+	std::ifstream computeShaderFile;
+	computeShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	try
+	{
+		computeShaderFile.open(computeShaderFilePath);
+		std::stringstream computeShaderStream;
+		computeShaderStream << computeShaderFile.rdbuf();
+		computeShaderFile.close();
+		computeCode = computeShaderStream.str();
+	}
+	catch (std::ifstream::failure e)
+	{
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+	}
+	const char* computeShaderSource = computeCode.c_str();
+
+	int  success;
+	char infoLog[512];
+
+	unsigned int computeShader;
+	computeShader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(computeShader, 1, &computeShaderSource, NULL);
+	glCompileShader(computeShader);
+
+	glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+		std::cin.get();
+	}
+
+	ID = glCreateProgram();
+	glAttachShader(ID, computeShader);
+	glLinkProgram(ID);
+	glGetProgramiv(ID, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(ID, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+	}
+
+	glDeleteShader(computeShader);
+}
+
 void Shader::use() {
 	glUseProgram(ID);
 }
@@ -145,6 +193,10 @@ void Shader::setVec2(const std::string &name, float x, float y) const
 {
 	glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
 }
+void Shader::setIVec2(const std::string &name, int x, int y) const
+{
+	glUniform2i(glGetUniformLocation(ID, name.c_str()), x, y);
+}
 void Shader::setVec3(const std::string &name, const glm::vec3 &value) const
 {
 	glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
@@ -172,4 +224,14 @@ void Shader::setMat3(const std::string &name, const glm::mat3 &mat) const
 void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const
 {
 	glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+}
+void Shader::cacheUniformLocations(const std::vector<std::string> &names)
+{
+	for (const std::string &name : names)
+		uniformLocations[name] = glGetUniformLocation(ID, name.c_str());
+}
+int Shader::getCachedUniformLocation(const std::string &name) const
+{
+	std::map<std::string, int>::const_iterator location = uniformLocations.find(name);
+	return location != uniformLocations.end() ? location->second : -1;
 }
\ No newline at end of file
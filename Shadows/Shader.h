@@ -9,6 +9,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <vector>
 
 
 class Shader {
@@ -19,6 +21,8 @@ public:
 
 	// constructor reads and builds the shader
 	Shader(const GLchar* vertexShaderFilePath, const GLchar* fragmentShaderFilePath, const char* geometryShaderFilePath = nullptr);
+	// compute only program, needs a GL 4.3 context
+	explicit Shader(const GLchar* computeShaderFilePath);
 
 	// use/activate the shader
 	void use();
@@ -28,6 +32,7 @@ public:
 	void setFloat(const std::string &name, float value) const;
 	void setVec2(const std::string &name, const glm::vec2 &value) const;
 	void setVec2(const std::string &name, float x, float y) const;
+	void setIVec2(const std::string &name, int x, int y) const;
 	void setVec3(const std::string &name, const glm::vec3 &value) const;
 	void setVec3(const std::string &name, float x, float y, float z) const;
 	void setVec4(const std::string &name, const glm::vec4 &value) const;
@@ -35,4 +40,12 @@ public:
 	void setMat2(const std::string &name, const glm::mat2 &mat) const;
 	void setMat3(const std::string &name, const glm::mat3 &mat) const;
 	void setMat4(const std::string &name, const glm::mat4 &mat) const;
+
+	// looks up and stores uniform locations so they can be read later without touching GL (e.g. from worker threads)
+	void cacheUniformLocations(const std::vector<std::string> &names);
+	// returns a location stored by cacheUniformLocations, -1 if the uniform wasn't cached or doesn't exist
+	int getCachedUniformLocation(const std::string &name) const;
+
+private:
+	std::map<std::string, int> uniformLocations;
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #version 330 core
+#extension GL_ARB_texture_cube_map_array : enable
 
 struct PointLight {
     vec3 position;
@@ -13,6 +14,22 @@ struct PointLight {
 };
 uniform PointLight pointLight;
 
+// clustered lights, see LightClusters
+uniform samplerBuffer lightData;      // 8 texels per light
+uniform usamplerBuffer clusterGrid;   // (offset, count) per cluster
+uniform usamplerBuffer lightIndices;  // light indices grouped by cluster
+uniform int clusterTilesX;
+uniform int clusterTilesY;
+uniform int clusterSlices;
+uniform float clusterSliceScale;
+uniform float clusterSliceBias;
+uniform vec2 screenSize;
+uniform mat4 view;
+#ifdef GL_ARB_texture_cube_map_array
+uniform samplerCubeArrayShadow lightShadows; // six layers per shadow slot, see ShadowManager
+#endif
+uniform sampler2DShadow shadowAtlas; // six tiles per light, two for a dual paraboloid, see ShadowAtlas
+
 out vec4 FragColor;
 
 in VS_OUT {
@@ -22,13 +39,20 @@ in VS_OUT {
 } fs_in;
 
 uniform sampler2D diffuseTexture;
+uniform bool useMaterialColor; // untextured materials are drawn in their diffuse colour
+uniform vec3 materialColor;
 uniform samplerCube depthMap;
+uniform samplerCubeShadow depthMapShadow; // same cubemap, compared and bilinearly filtered by the sampler
+uniform samplerCube momentsMap;            // blurred depth and depth squared, mipmapped
+uniform float bleedReduction;
 
 //uniform vec3 lightPos;
 uniform vec3 viewPos;
 
 uniform float far_plane;
+uniform float lightRadius; // past this the shadow light is below its cutoff and isn't shaded at all
 uniform bool displayDepth;
+uniform int shadowFilter; // 0: 20 manual taps, 1: 4 hardware PCF taps, 2: variance shadow map
 
 // array of offset direction for sampling
 vec3 gridSamplingDisk[20] = vec3[]
@@ -40,6 +64,12 @@ vec3 gridSamplingDisk[20] = vec3[]
    vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
 );
 
+// tetrahedron corners, spread along every axis whichever face the lookup lands on
+vec3 hardwareSamplingDisk[4] = vec3[]
+(
+   vec3(1, 1, 1), vec3(1, -1, -1), vec3(-1, 1, -1), vec3(-1, -1, 1)
+);
+
 float ShadowCalculation()
 {
     // get vector between fragment position and light position
@@ -55,7 +85,34 @@ float ShadowCalculation()
 	float bias = 0.15; // we use a much larger bias since depth is now in [near_plane, far_plane] range
     float shadow = currentDepth -  bias > closestDepth ? 1.0 : 0.0;
 
-	if(currentDepth > 8.0f && shadow != 0.0f)
+	if(shadowFilter == 2)
+	{
+		// Chebyshev's upper bound on how much of the filtered area is lit, anything below the bleed reduction
+		// fraction is treated as fully in shadow
+		vec2 moments = texture(momentsMap, fragToLight).rg;
+		float depth = currentDepth / far_plane;
+		float lit = 1.0;
+		if(depth > moments.x)
+		{
+			float variance = max(moments.y - moments.x * moments.x, 0.00002);
+			float difference = depth - moments.x;
+			lit = variance / (variance + difference * difference);
+			lit = clamp((lit - bleedReduction) / (1.0 - bleedReduction), 0.0, 1.0);
+		}
+		shadow = 1.0 - lit;
+	}
+	else if(shadowFilter == 1)
+	{
+		// each tap already averages the comparison of four texels, a few of them cover the manual disk
+		float viewDistance = length(viewPos - fs_in.FragPos);
+		float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
+		float reference = (currentDepth - bias) / far_plane;
+		float lit = 0.0;
+		for(int i = 0; i < 4; ++i)
+			lit += texture(depthMapShadow, vec4(fragToLight + hardwareSamplingDisk[i] * diskRadius, reference));
+		shadow = 1.0 - lit / 4.0;
+	}
+	else if(currentDepth > 8.0f && shadow != 0.0f)
 	{
 		//PCF
 		shadow = 0.0f;
@@ -80,10 +137,113 @@ float ShadowCalculation()
     return shadow;
 }
 
+// one hardware PCF lookup in a light's atlas tiles, the face is picked the way a cube map lookup picks it
+float AtlasShadow(int index, vec4 tile, vec3 fromLight, float distance)
+{
+    vec3 a = abs(fromLight);
+    int face;
+    vec2 st;
+    float major;
+    if(a.x >= a.y && a.x >= a.z)
+    {
+        major = a.x;
+        face = fromLight.x > 0.0 ? 0 : 1;
+        st = fromLight.x > 0.0 ? vec2(-fromLight.z, -fromLight.y) : vec2(fromLight.z, -fromLight.y);
+    }
+    else if(a.y >= a.z)
+    {
+        major = a.y;
+        face = fromLight.y > 0.0 ? 2 : 3;
+        st = fromLight.y > 0.0 ? vec2(fromLight.x, fromLight.z) : vec2(fromLight.x, -fromLight.z);
+    }
+    else
+    {
+        major = a.z;
+        face = fromLight.z > 0.0 ? 4 : 5;
+        st = fromLight.z > 0.0 ? vec2(fromLight.x, -fromLight.y) : vec2(-fromLight.x, -fromLight.y);
+    }
+
+    // two tile origins per texel, and half a texel in from the tile's edge so the filter never reads a neighbour
+    vec4 origins = texelFetch(lightData, index * 8 + 5 + face / 2);
+    vec2 origin = (face % 2) == 0 ? origins.xy : origins.zw;
+    float border = 0.5 / tile.w;
+    vec2 uv = clamp(st / major * 0.5 + 0.5, border, 1.0 - border);
+    return texture(shadowAtlas, vec3(origin + uv * tile.z, (distance - 0.05) / tile.y));
+}
+
+// the same lookup in a dual paraboloid's two tiles, the half above the light and the half below, each folded onto
+// a disk the way pointLShadowsParaboloid.vert folds it
+float ParaboloidShadow(int index, vec4 tile, vec3 fromLight, float distance)
+{
+    vec3 direction = fromLight / distance;
+    float hemisphere = direction.y >= 0.0 ? 1.0 : -1.0;
+    vec4 origins = texelFetch(lightData, index * 8 + 5);
+    vec2 origin = hemisphere > 0.0 ? origins.xy : origins.zw;
+    float border = 0.5 / tile.w;
+    vec2 disk = vec2(direction.x * hemisphere, direction.z);
+    vec2 uv = clamp(disk / (1.0 + hemisphere * direction.y) * 0.5 + 0.5, border, 1.0 - border);
+    return texture(shadowAtlas, vec3(origin + uv * tile.z, (distance - 0.05) / tile.y));
+}
+
+// shades one of the clustered lights, shadowed by one hardware PCF lookup when the light has a shadow slot or
+// atlas tiles
+vec3 CalcClusteredLight(int index, vec3 norm, vec3 viewDir, vec3 color)
+{
+    vec4 positionRadius = texelFetch(lightData, index * 8);
+    vec4 ambientConstant = texelFetch(lightData, index * 8 + 1);
+    vec4 diffuseLinear = texelFetch(lightData, index * 8 + 2);
+    vec4 specularQuadratic = texelFetch(lightData, index * 8 + 3);
+    vec4 shadowSlotFar = texelFetch(lightData, index * 8 + 4);
+
+    vec3 toLight = positionRadius.xyz - fs_in.FragPos;
+    float distance = length(toLight);
+    if(distance >= positionRadius.w)
+        return vec3(0.0);
+
+    vec3 lightDir = toLight / distance;
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), 32.0);
+
+    // fade out towards the light's range so cluster borders don't show
+    float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (ambientConstant.w + diffuseLinear.w * distance + specularQuadratic.w * (distance * distance));
+
+    float lit = 1.0;
+#ifdef GL_ARB_texture_cube_map_array
+    if(shadowSlotFar.x >= 0.0)
+        lit = texture(lightShadows, vec4(-toLight, shadowSlotFar.x), (distance - 0.05) / shadowSlotFar.y);
+#endif
+    if(shadowSlotFar.z > 0.0 && shadowSlotFar.x < -1.5)
+        lit = ParaboloidShadow(index, shadowSlotFar, -toLight, distance);
+    else if(shadowSlotFar.z > 0.0)
+        lit = AtlasShadow(index, shadowSlotFar, -toLight, distance);
+
+    vec3 ambient  = ambientConstant.rgb * color;
+    vec3 diffuse  = diffuseLinear.rgb * diff * color;
+    vec3 specular = specularQuadratic.rgb * spec * vec3(0.3f);
+    return (ambient + lit * (diffuse + specular)) * attenuation * color;
+}
+
+vec3 CalcClusteredLights(vec3 norm, vec3 viewDir, vec3 color)
+{
+    // find this fragment's cluster from its screen tile and view depth
+    float depth = -(view * vec4(fs_in.FragPos, 1.0)).z;
+    int slice = clamp(int(log(depth) * clusterSliceScale + clusterSliceBias), 0, clusterSlices - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / screenSize * vec2(clusterTilesX, clusterTilesY)), ivec2(0), ivec2(clusterTilesX - 1, clusterTilesY - 1));
+    int cluster = tile.x + tile.y * clusterTilesX + slice * clusterTilesX * clusterTilesY;
+
+    uvec2 offsetCount = texelFetch(clusterGrid, cluster).rg;
+    vec3 result = vec3(0.0);
+    for(uint i = 0u; i < offsetCount.y; ++i)
+        result += CalcClusteredLight(int(texelFetch(lightIndices, int(offsetCount.x + i)).r), norm, viewDir, color);
+    return result;
+}
+
 void main()
 {
 	// properties
-	vec3 color = texture(diffuseTexture, fs_in.TexCoords).rgb;
+	vec3 color = useMaterialColor ? materialColor : texture(diffuseTexture, fs_in.TexCoords).rgb;
     vec3 norm = normalize(fs_in.Normal);
     vec3 viewDir = normalize(viewPos - fs_in.FragPos);
 
@@ -102,16 +262,22 @@ void main()
     float attenuation = 1.0 / (pointLight.constant + pointLight.linear * distance + pointLight.quadratic * (distance * distance)); 
 				 
     // combine results
-    vec3 ambient  = pointLight.ambient  * vec3(texture(diffuseTexture, fs_in.TexCoords));
-    vec3 diffuse  = pointLight.diffuse  * diff * vec3(texture(diffuseTexture, fs_in.TexCoords));
+    vec3 ambient  = pointLight.ambient  * color;
+    vec3 diffuse  = pointLight.diffuse  * diff * color;
     vec3 specular = pointLight.specular * spec * vec3(0.3f);//vec3(texture(material.specular, TexCoords));
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
 
-	// Calculate Shadows
-	float shadows = ShadowCalculation();
-	vec3 lighting = (ambient + (1.0 - shadows) * (diffuse + specular)) * color;  
+	// Calculate Shadows, receivers out of the light's reach skip the cubemap lookups. Ambient isn't shadowed and
+	// reaches everywhere
+	vec3 lighting = ambient * color;
+	if(distance < lightRadius || displayDepth)
+	{
+		float shadows = ShadowCalculation();
+		lighting += (1.0 - shadows) * (diffuse + specular) * color;
+	}
+	lighting += CalcClusteredLights(norm, viewDir, color);
 
     if(!displayDepth){
 		FragColor = vec4(lighting, 1.0);
@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth only, the occluder pass and the query boxes don't write colour
+void main()
+{
+}
@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec4 aPos;  // normalised to the mesh bounds
+
+uniform mat4 model;
+uniform mat4 viewProjection;
+
+// undo the position quantisation (see VertexPacking.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+void main()
+{
+    gl_Position = viewProjection * model * vec4(positionOffset + aPos.xyz * positionScale, 1.0);
+}
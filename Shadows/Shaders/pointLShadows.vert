@@ -1,7 +1,8 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 0) in vec4 aPos;       // normalised to the mesh bounds, w = bitangent sign
+layout (location = 1) in vec2 aNormal;    // octahedral encoded
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec2 aTangent;   // octahedral encoded
 
 out vec2 TexCoords;
 
@@ -15,13 +16,29 @@ uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
 
+// undo the position quantisation (see VertexPacking.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));
+    vec3 position = positionOffset + aPos.xyz * positionScale;
+    vec3 normal = octDecode(aNormal);
+
+    vs_out.FragPos = vec3(model * vec4(position, 1.0));
 //    if(reverse_normals) // a slight hack to make sure the outer large cube displays lighting from the 'inside' instead of the default 'outside'.
-//        vs_out.Normal = transpose(inverse(mat3(model))) * (-1.0 * aNormal);
+//        vs_out.Normal = transpose(inverse(mat3(model))) * (-1.0 * normal);
 //    else
-    vs_out.Normal = transpose(inverse(mat3(model))) * aNormal;
+    vs_out.Normal = transpose(inverse(mat3(model))) * normal;
     vs_out.TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    gl_Position = projection * view * model * vec4(position, 1.0);
+}
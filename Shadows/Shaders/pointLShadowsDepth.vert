@@ -1,9 +1,13 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+layout (location = 0) in vec4 aPos;  // normalised to the mesh bounds
 
 uniform mat4 model;
 
+// undo the position quantisation (see VertexPacking.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
 void main()
 {
-    gl_Position = model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    gl_Position = model * vec4(positionOffset + aPos.xyz * positionScale, 1.0);
+}
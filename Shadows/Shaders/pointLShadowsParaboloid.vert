@@ -0,0 +1,26 @@
+#version 330 core
+layout (location = 0) in vec4 aPos;  // normalised to the mesh bounds
+
+uniform mat4 model;
+
+// undo the position quantisation (see VertexPacking.h)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+uniform vec3 lightPos;
+uniform float hemisphere; // 1 draws the half of the sphere above the light, -1 the half below
+
+out vec4 FragPos; // pointLShadowsDepth.frag writes the distance to the light from it, as the cube faces do
+
+// dual paraboloid: the directions of one half of the sphere fold onto the unit disk, no geometry shader needed.
+// The fold is per vertex, so long edges stay straight where they should curve
+void main()
+{
+    FragPos = model * vec4(positionOffset + aPos.xyz * positionScale, 1.0);
+    vec3 direction = normalize(FragPos.xyz - lightPos);
+    // x flips for the lower half, seen from below it is mirrored and culling would keep the back faces
+    vec2 disk = vec2(direction.x * hemisphere, direction.z);
+    gl_Position = vec4(disk / max(1.0 + hemisphere * direction.y, 0.0001), 0.0, 1.0);
+    // the other half folds out towards infinity, triangles reaching over get cut at the equator
+    gl_ClipDistance[0] = hemisphere * direction.y;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec2 FaceCoords; // [-1, 1] across the cube face being written
+
+void main()
+{
+    // one triangle covering the viewport
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    FaceCoords = position;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -0,0 +1,49 @@
+#version 330 core
+
+in vec2 FaceCoords;
+
+out vec2 Moments;
+
+uniform samplerCube source;  // the depth cubemap on the first pass, the horizontal result on the second
+uniform bool fromDepth;      // source holds distance / far plane, the moments are made per tap
+uniform bool vertical;
+uniform int face;
+uniform int radius;
+uniform float texelSize;     // of the destination, in face coordinates
+
+// direction through face coordinates (s, t) of a cube face, the inverse of the GL face selection
+vec3 faceDirection(vec2 st)
+{
+    if(face == 0) return vec3(1.0, -st.y, -st.x);
+    if(face == 1) return vec3(-1.0, -st.y, st.x);
+    if(face == 2) return vec3(st.x, 1.0, st.y);
+    if(face == 3) return vec3(st.x, -1.0, -st.y);
+    if(face == 4) return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+void main()
+{
+    // gaussian over 2 * radius + 1 taps. Taps past the edge of the face keep going in the same direction and so
+    // land on the neighbouring face
+    vec2 step = vertical ? vec2(0.0, texelSize) : vec2(texelSize, 0.0);
+    float sigma = max(float(radius) * 0.5, 0.5);
+    vec2 sum = vec2(0.0);
+    float weightSum = 0.0;
+    for(int i = -radius; i <= radius; ++i)
+    {
+        float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+        vec3 direction = faceDirection(FaceCoords + step * float(i));
+        vec2 value;
+        if(fromDepth)
+        {
+            float depth = texture(source, direction).r;
+            value = vec2(depth, depth * depth);
+        }
+        else
+            value = texture(source, direction).rg;
+        sum += value * weight;
+        weightSum += weight;
+    }
+    Moments = sum / weightSum;
+}
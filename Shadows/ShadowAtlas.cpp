@@ -0,0 +1,339 @@
+#include "ShadowAtlas.h"
+#include "ShadowManager.h"
+#include "LightClusters.h"
+#include "Culling.h"
+#include "shadowFBO.h"
+
+#include <algorithm>
+#include <iostream>
+
+void QuadtreeAllocator::reset(unsigned int _size, unsigned int _minSize)
+{
+	size = _size;
+	minSize = _minSize;
+	// one node per square of every size from the full one down to the minimum
+	size_t count = 0, levelCount = 1;
+	for (unsigned int nodeSize = _size; nodeSize >= _minSize && nodeSize > 0; nodeSize /= 2)
+	{
+		count += levelCount;
+		levelCount *= 4;
+	}
+	nodes.assign(count, Free);
+}
+
+bool QuadtreeAllocator::allocate(unsigned int _size, glm::uvec2 &_origin)
+{
+	if (_size < minSize || _size > size)
+		return false;
+	return allocate(0, glm::uvec2(0), size, _size, _origin);
+}
+
+void QuadtreeAllocator::release(glm::uvec2 _origin, unsigned int _size)
+{
+	release(0, glm::uvec2(0), size, _origin, _size);
+}
+
+bool QuadtreeAllocator::allocate(unsigned int _node, glm::uvec2 _nodeOrigin, unsigned int _nodeSize, unsigned int _size, glm::uvec2 &_origin)
+{
+	if (nodes[_node] == Taken)
+		return false;
+	if (_nodeSize == _size)
+	{
+		if (nodes[_node] != Free)
+			return false;
+		nodes[_node] = Taken;
+		_origin = _nodeOrigin;
+		return true;
+	}
+
+	unsigned int half = _nodeSize / 2;
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		if (allocate(_node * 4 + 1 + i, _nodeOrigin + glm::uvec2(i & 1, i >> 1) * half, half, _size, _origin))
+		{
+			nodes[_node] = Split;
+			return true;
+		}
+	}
+	return false;
+}
+
+void QuadtreeAllocator::release(unsigned int _node, glm::uvec2 _nodeOrigin, unsigned int _nodeSize, glm::uvec2 _origin, unsigned int _size)
+{
+	if (_nodeSize == _size)
+	{
+		nodes[_node] = Free;
+		return;
+	}
+
+	unsigned int half = _nodeSize / 2;
+	unsigned int quarter = (_origin.x >= _nodeOrigin.x + half ? 1 : 0) + (_origin.y >= _nodeOrigin.y + half ? 2 : 0);
+	release(_node * 4 + 1 + quarter, _nodeOrigin + glm::uvec2(quarter & 1, quarter >> 1) * half, half, _origin, _size);
+
+	// the last quarter given back merges the node
+	unsigned int first = _node * 4 + 1;
+	if (nodes[first] == Free && nodes[first + 1] == Free && nodes[first + 2] == Free && nodes[first + 3] == Free)
+		nodes[_node] = Free;
+}
+
+void ShadowAtlas::configure()
+{
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, depthFormat, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	// one hardware PCF lookup per light, the shader keeps it inside the tile
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cout << "ERROR::SHADOWATLAS:: framebuffer is not complete" << std::endl;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	allocator.reset(size, minTile);
+
+	std::cout << "SHADOWATLAS:: " << size << "x" << size << " atlas, tiles of " << minTile << " to " << maxTile << ", "
+		<< (size_t)size * size * 2 / (1024 * 1024) << " MB" << std::endl;
+}
+
+void ShadowAtlas::assign(const std::vector<PointLight> &_lights, float _lightCutoff, const glm::mat4 &_viewProjection, glm::vec3 _eye,
+	float _pixelScale, bool _sceneChanged)
+{
+	pending.clear();
+	for (size_t i = _lights.size(); i < allocations.size(); i++)
+		releaseTiles(allocations[i]);
+	allocations.resize(_lights.size());
+
+	std::vector<ShadowManager::RankedLight> ranked = ShadowManager::rankLights(_lights, _lightCutoff, _viewProjection, _eye);
+	if (ranked.size() > maxLights)
+		ranked.resize(maxLights);
+
+	// what each light asks for now, nothing off screen. Lights that dropped out or changed size or projection give
+	// their tiles back, the others keep theirs and their maps
+	std::vector<unsigned int> requests(allocations.size(), 0);
+	std::vector<ShadowProjection> projections(allocations.size(), ShadowProjection::Cube);
+	for (const ShadowManager::RankedLight &entry : ranked)
+	{
+		unsigned int request = requestedSize(entry.angularSize * _pixelScale * texelsPerPixel, allocations[entry.light].requested);
+		ShadowProjection projection = _lights[entry.light].shadowProjection;
+		if (forcedProjection != ShadowProjection::Automatic)
+			projection = forcedProjection;
+		if (projection == ShadowProjection::Automatic)
+			projection = request <= paraboloidMaxTile ? ShadowProjection::DualParaboloid : ShadowProjection::Cube;
+		requests[entry.light] = request;
+		projections[entry.light] = projection;
+	}
+	for (unsigned int i = 0; i < allocations.size(); i++)
+	{
+		if (requests[i] == allocations[i].requested && projections[i] == allocations[i].projection)
+			continue;
+		releaseTiles(allocations[i]);
+		allocations[i].requested = requests[i];
+		allocations[i].projection = projections[i];
+	}
+
+	// newcomers take what's free, most important first. One that doesn't fit means the atlas is too fragmented
+	// or too full, and everything gets packed again
+	bool fits = true;
+	std::vector<unsigned int> rankedLights;
+	for (const ShadowManager::RankedLight &entry : ranked)
+	{
+		Allocation &allocation = allocations[entry.light];
+		allocation.impact = entry.impact;
+		rankedLights.push_back(entry.light);
+		if (allocation.tileSize == 0 && !allocateTiles(allocation, allocation.requested))
+			fits = false;
+	}
+	if (!fits)
+		repack(rankedLights);
+
+	for (const ShadowManager::RankedLight &entry : ranked)
+	{
+		Allocation &allocation = allocations[entry.light];
+		if (allocation.tileSize == 0)
+			continue;
+		if (!allocation.drawn || _sceneChanged || updateAll || allocation.position != _lights[entry.light].position ||
+			allocation.range != entry.range)
+			allocation.dirty = true;
+		allocation.position = _lights[entry.light].position;
+		allocation.range = entry.range;
+		if (allocation.dirty)
+			pending.push_back(entry.light);
+	}
+
+	// never drawn lights before stale ones, then by impact
+	std::sort(pending.begin(), pending.end(), [&](unsigned int _a, unsigned int _b) {
+		if (allocations[_a].drawn != allocations[_b].drawn)
+			return !allocations[_a].drawn;
+		return allocations[_a].impact > allocations[_b].impact;
+	});
+	if (pending.size() > maxUpdatesPerFrame && !updateAll)
+		pending.resize(maxUpdatesPerFrame);
+}
+
+void ShadowAtlas::bindLight(unsigned int _light, Shader &_shader)
+{
+	Allocation &allocation = allocations[_light];
+	unsigned int faces = faceCount(allocation.projection);
+
+	// the rest of the atlas belongs to the other lights
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glEnable(GL_SCISSOR_TEST);
+	for (unsigned int i = 0; i < faces; i++)
+	{
+		glScissor(allocation.tiles[i].x, allocation.tiles[i].y, allocation.tileSize, allocation.tileSize);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+	glDisable(GL_SCISSOR_TEST);
+
+	// the paraboloids only need the light's position, the vertex shader folds the directions itself
+	if (allocation.projection == ShadowProjection::Cube)
+	{
+		float nearPlane = std::max(0.05f, allocation.range * 0.01f);
+		allocation.matrices = ShadowFBO::cubeFaceMatrices(allocation.position, nearPlane, allocation.range);
+		for (unsigned int i = 0; i < 6; i++)
+			_shader.setMat4("shadowMatrices[" + std::to_string(i) + "]", allocation.matrices[i]);
+		_shader.setInt("layerBase", 0);
+	}
+	else
+		allocation.matrices.clear();
+	_shader.setVec3("lightPos", allocation.position);
+	_shader.setFloat("far_plane", allocation.range);
+
+	allocation.drawn = true;
+	allocation.dirty = false;
+}
+
+void ShadowAtlas::bindFace(unsigned int _light, unsigned int _face, Shader &_shader)
+{
+	const Allocation &allocation = allocations[_light];
+	glViewport(allocation.tiles[_face].x, allocation.tiles[_face].y, allocation.tileSize, allocation.tileSize);
+	if (allocation.projection == ShadowProjection::DualParaboloid)
+		_shader.setFloat("hemisphere", _face == 0 ? 1.0f : -1.0f);
+	else
+		_shader.setInt("skipFaces", allCubeFaces & ~(1u << _face));
+}
+
+const std::vector<glm::vec4> &ShadowAtlas::getShadowData()
+{
+	shadowData.assign(allocations.size() * LightClusters::shadowTexels, glm::vec4(0.0f));
+	for (unsigned int i = 0; i < allocations.size(); i++)
+	{
+		const Allocation &allocation = allocations[i];
+		glm::vec4 *texels = &shadowData[i * LightClusters::shadowTexels];
+		if (allocation.tileSize == 0 || !allocation.drawn)
+		{
+			texels[0] = glm::vec4(-1.0f, 1.0f, 0.0f, 0.0f);
+			continue;
+		}
+		float kind = allocation.projection == ShadowProjection::DualParaboloid ? -2.0f : -1.0f;
+		texels[0] = glm::vec4(kind, allocation.range, (float)allocation.tileSize / size, (float)allocation.tileSize);
+		for (unsigned int j = 0; j < faceCount(allocation.projection) / 2; j++)
+			texels[j + 1] = glm::vec4(glm::vec2(allocation.tiles[j * 2]), glm::vec2(allocation.tiles[j * 2 + 1])) / (float)size;
+	}
+	return shadowData;
+}
+
+void ShadowAtlas::bindTexture()
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// the next power of two up, but a light close to the edge of its size keeps it rather than flip every frame
+unsigned int ShadowAtlas::requestedSize(float _screenSize, unsigned int _current) const
+{
+	if (_current > 0 && _screenSize > _current * 0.35f && _screenSize <= _current * 1.5f)
+		return _current;
+	unsigned int tile = minTile;
+	while (tile < maxTile && tile < _screenSize)
+		tile *= 2;
+	return tile;
+}
+
+// a tile of _size for every face or none at all
+bool ShadowAtlas::allocateTiles(Allocation &_allocation, unsigned int _size)
+{
+	for (unsigned int i = 0; i < faceCount(_allocation.projection); i++)
+	{
+		if (allocator.allocate(_size, _allocation.tiles[i]))
+			continue;
+		for (unsigned int j = 0; j < i; j++)
+			allocator.release(_allocation.tiles[j], _size);
+		return false;
+	}
+	_allocation.tileSize = _size;
+	_allocation.drawn = false;
+	return true;
+}
+
+void ShadowAtlas::releaseTiles(Allocation &_allocation)
+{
+	if (_allocation.tileSize == 0)
+		return;
+	for (unsigned int i = 0; i < faceCount(_allocation.projection); i++)
+		allocator.release(_allocation.tiles[i], _allocation.tileSize);
+	_allocation.tileSize = 0;
+	_allocation.drawn = false;
+}
+
+// places every tile again, largest first: power of two squares that go into a quadtree biggest first fit as long
+// as their area does. Requests over the atlas' area are halved first, the largest and then the least important.
+// Lights given back the same tiles keep their maps
+void ShadowAtlas::repack(const std::vector<unsigned int> &_lights)
+{
+	size_t capacity = (size_t)size * size, total = 0;
+	std::vector<unsigned int> sizes(_lights.size());
+	for (unsigned int i = 0; i < _lights.size(); i++)
+	{
+		sizes[i] = allocations[_lights[i]].requested;
+		total += faceCount(allocations[_lights[i]].projection) * (size_t)sizes[i] * sizes[i];
+	}
+	while (total > capacity)
+	{
+		unsigned int largest = 0;
+		for (unsigned int i = 0; i < sizes.size(); i++)
+			if (sizes[i] >= sizes[largest])
+				largest = i;
+		size_t faces = faceCount(allocations[_lights[largest]].projection);
+		total -= faces * sizes[largest] * sizes[largest];
+		sizes[largest] = sizes[largest] > minTile ? sizes[largest] / 2 : 0;
+		total += faces * sizes[largest] * sizes[largest];
+	}
+
+	std::vector<Allocation> before(allocations);
+	for (Allocation &allocation : allocations)
+		releaseTiles(allocation);
+
+	// ties by light index, so the same requests always come out in the same place
+	std::vector<unsigned int> order(_lights.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](unsigned int _a, unsigned int _b) {
+		if (sizes[_a] != sizes[_b])
+			return sizes[_a] > sizes[_b];
+		return _lights[_a] < _lights[_b];
+	});
+	for (unsigned int i : order)
+	{
+		if (sizes[i] == 0)
+			continue;
+		Allocation &allocation = allocations[_lights[i]];
+		const Allocation &previous = before[_lights[i]];
+		if (!allocateTiles(allocation, sizes[i]))
+			continue;
+		allocation.drawn = previous.drawn && previous.tileSize == allocation.tileSize &&
+			std::equal(allocation.tiles, allocation.tiles + faceCount(allocation.projection), previous.tiles);
+	}
+}
@@ -0,0 +1,122 @@
+#ifndef _SHADOWATLAS_H_
+#define _SHADOWATLAS_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "PointLight.h"
+
+#include <vector>
+
+// Power of two squares handed out of a power of two square. Every node of the tree is free, split into four
+// quarters or taken, and a split node whose quarters are all free again merges back.
+class QuadtreeAllocator {
+public:
+	void reset(unsigned int _size, unsigned int _minSize);
+	// false when no free square of _size is left, _size is a power of two from the minimum up to the full size
+	bool allocate(unsigned int _size, glm::uvec2 &_origin);
+	void release(glm::uvec2 _origin, unsigned int _size);
+
+private:
+	enum NodeState : unsigned char { Free, Split, Taken };
+
+	unsigned int size = 0;
+	unsigned int minSize = 0;
+	std::vector<NodeState> nodes;	// implicit tree, the quarters of node n are 4n + 1 to 4n + 4
+
+	bool allocate(unsigned int _node, glm::uvec2 _nodeOrigin, unsigned int _nodeSize, unsigned int _size, glm::uvec2 &_origin);
+	void release(unsigned int _node, glm::uvec2 _nodeOrigin, unsigned int _nodeSize, glm::uvec2 _origin, unsigned int _size);
+};
+
+// Shadows for the clustered point lights in one 2D depth texture of fixed size. Each light on screen gets six
+// square tiles, one per cube face, sized by how much of the screen its reach covers, so a close light gets a
+// sharp shadow and a distant one a few texels. A light keeps its tiles while its size doesn't change; when a
+// newcomer doesn't fit every tile is repacked largest first, and when the lights want more than the atlas holds
+// the largest requests are halved until they fit. More lights mean smaller tiles, never more memory.
+// Tiles are redrawn like ShadowManager's slots: when the light moves, the scene changes or the tiles moved, and
+// only a few lights per frame. Only needs GL 3.3, the faces are drawn one viewport at a time.
+// A light can instead be a dual paraboloid: two tiles, each half of the sphere folded onto a disk by the vertex
+// shader, drawn in two passes without the geometry shader. Edges that would curve stay straight, so a triangle
+// spanning a large angle from the light lands well off its true depth whatever the tile size. Furniture sized
+// triangles bend their shadows a little; the room's walls would shadow themselves, so they are left out of these
+// passes.
+class ShadowAtlas {
+public:
+	// texture unit the atlas is sampled from, compared and filtered by the texture's own sampler state
+	static const unsigned int textureUnit = 6;
+	static const unsigned int size = 4096;
+	static const unsigned int minTile = 64;
+	static const unsigned int maxTile = 1024;
+	static const GLenum depthFormat = GL_DEPTH_COMPONENT16;
+
+	unsigned int maxLights = 32;
+	// lights drawn per frame at most, the time budget
+	unsigned int maxUpdatesPerFrame = 3;
+	// shadow texels per screen pixel, matched half way out to the light's range
+	float texelsPerPixel = 0.5f;
+	// Automatic lights asking for tiles this small or smaller get dual paraboloids
+	unsigned int paraboloidMaxTile = 128;
+	// the benchmark holds every light to one projection and redraws all of them each frame
+	ShadowProjection forcedProjection = ShadowProjection::Automatic;
+	bool updateAll = false;
+
+	void configure();
+
+	// ranks the lights and sizes and places their tiles. _pixelScale turns the camera's angles into pixels,
+	// _sceneChanged redraws every light
+	void assign(const std::vector<PointLight> &_lights, float _lightCutoff, const glm::mat4 &_viewProjection, glm::vec3 _eye,
+		float _pixelScale, bool _sceneChanged);
+
+	// lights to draw this frame, most important first
+	const std::vector<unsigned int> &getPendingLights() const { return pending; }
+	// binds the atlas, clears the light's tiles and sets up the depth shader
+	void bindLight(unsigned int _light, Shader &_shader);
+	// points the viewport at one face's tile, the casters drawn after it only land in that face. A dual
+	// paraboloid has two faces, the half above the light and the half below
+	void bindFace(unsigned int _light, unsigned int _face, Shader &_shader);
+	// Cube or DualParaboloid, never Automatic
+	ShadowProjection getProjection(unsigned int _light) const { return allocations[_light].projection; }
+	unsigned int getFaceCount(unsigned int _light) const { return faceCount(allocations[_light].projection); }
+	glm::vec3 getLightPosition(unsigned int _light) const { return allocations[_light].position; }
+	float getLightRange(unsigned int _light) const { return allocations[_light].range; }
+	unsigned int getTileSize(unsigned int _light) const { return allocations[_light].tileSize; }
+	const std::vector<glm::mat4> &getLightMatrices(unsigned int _light) const { return allocations[_light].matrices; }
+
+	// per light: (-1, or -2 for a dual paraboloid, far plane, tile size in atlas units, tile size in texels) and the
+	// tile origins, two per texel, the light clusters' shadow texels
+	const std::vector<glm::vec4> &getShadowData();
+
+	void bindTexture();
+
+private:
+	struct Allocation {
+		unsigned int requested = 0;		// tile size the light's screen coverage asks for
+		unsigned int tileSize = 0;		// what it got, 0 without tiles
+		ShadowProjection projection = ShadowProjection::Cube;
+		glm::uvec2 tiles[6];
+		glm::vec3 position = glm::vec3(0.0f);
+		float range = 0.0f;
+		float impact = 0.0f;
+		bool drawn = false;		// the tiles hold this light's map, maybe from before it last moved
+		bool dirty = true;
+		std::vector<glm::mat4> matrices;
+	};
+
+	unsigned int texture;
+	unsigned int FBO;
+	QuadtreeAllocator allocator;
+
+	std::vector<Allocation> allocations;	// per light
+	std::vector<unsigned int> pending;
+	std::vector<glm::vec4> shadowData;
+
+	static unsigned int faceCount(ShadowProjection _projection) { return _projection == ShadowProjection::DualParaboloid ? 2 : 6; }
+	unsigned int requestedSize(float _screenSize, unsigned int _current) const;
+	bool allocateTiles(Allocation &_allocation, unsigned int _size);
+	void releaseTiles(Allocation &_allocation);
+	void repack(const std::vector<unsigned int> &_lights);
+};
+
+#endif
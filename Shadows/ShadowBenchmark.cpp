@@ -0,0 +1,55 @@
+#include "ShadowBenchmark.h"
+#include "Profiler.h"
+
+#include <iostream>
+
+void ShadowBenchmark::start()
+{
+	frame = 0;
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		microseconds[i] = 0;
+		lightsDrawn[i] = 0;
+	}
+}
+
+ShadowProjection ShadowBenchmark::getProjection() const
+{
+	if (!isRunning())
+		return ShadowProjection::Automatic;
+	return (unsigned int)frame < warmupFrames + measuredFrames ? ShadowProjection::Cube : ShadowProjection::DualParaboloid;
+}
+
+void ShadowBenchmark::endFrame()
+{
+	if (!isRunning())
+		return;
+
+	unsigned int halfLength = warmupFrames + measuredFrames;
+	if ((unsigned int)frame % halfLength >= warmupFrames)
+	{
+		unsigned int paraboloids = profiler.getLastFrame(ProfileCounter::ParaboloidShadowsDrawn);
+		if ((unsigned int)frame < halfLength)
+		{
+			microseconds[0] += profiler.getLastFrame(ProfileCounter::CubeShadowMicroseconds);
+			lightsDrawn[0] += profiler.getLastFrame(ProfileCounter::ShadowSlotsDrawn) - paraboloids;
+		}
+		else
+		{
+			microseconds[1] += profiler.getLastFrame(ProfileCounter::ParaboloidShadowMicroseconds);
+			lightsDrawn[1] += paraboloids;
+		}
+	}
+	if ((unsigned int)++frame < 2 * halfLength)
+		return;
+	frame = -1;
+
+	if (lightsDrawn[0] == 0 || lightsDrawn[1] == 0)
+	{
+		std::cout << "SHADOWBENCHMARK:: no shadowed lights on screen, place some with L" << std::endl;
+		return;
+	}
+	std::cout << "SHADOWBENCHMARK:: " << lightsDrawn[0] / measuredFrames << " lights a frame, cube maps "
+		<< microseconds[0] / lightsDrawn[0] << " us per light, dual paraboloids " << microseconds[1] / lightsDrawn[1]
+		<< " us per light" << std::endl;
+}
@@ -0,0 +1,28 @@
+#ifndef _SHADOWBENCHMARK_H_
+#define _SHADOWBENCHMARK_H_
+
+#include "PointLight.h"
+
+// Compares the two point light shadow projections on the GPU. While it runs, the shadow atlas redraws every light
+// it shadows each frame, first all of them as cube maps and then all as dual paraboloids, and the GPU time per
+// light of each is printed at the end. The times come from the profiler's counters, which the GPU timers fill a
+// few frames late, so each half starts with frames that aren't counted.
+class ShadowBenchmark {
+public:
+	const unsigned int warmupFrames = 10;
+	const unsigned int measuredFrames = 120;
+
+	void start();
+	bool isRunning() const { return frame >= 0; }
+	// what the shadow atlas is held to this frame, Automatic while not running
+	ShadowProjection getProjection() const;
+	// after the profiler has closed the frame
+	void endFrame();
+
+private:
+	int frame = -1;
+	unsigned long long microseconds[2] = {};
+	unsigned long long lightsDrawn[2] = {};
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "ShadowManager.h"
+#include "Culling.h"
+#include "shadowFBO.h"
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <iostream>
+
+void ShadowManager::configure()
+{
+	supported = GLAD_GL_VERSION_4_0 != 0;
+	if (!supported)
+	{
+		std::cout << "SHADOWMANAGER:: needs OpenGL 4.0 for cube map arrays, the small lights stay unshadowed" << std::endl;
+		return;
+	}
+
+	size_t slotSize = 6 * (size_t)resolution * resolution * 4;
+	slotCount = (unsigned int)std::min((size_t)maxSlots, memoryBudget / slotSize);
+	if (slotCount == 0)
+	{
+		supported = false;
+		return;
+	}
+	slots.resize(slotCount);
+
+	glGenTextures(1, &cubemapArray);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubemapArray);
+	glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, depthFormat, resolution, resolution, slotCount * 6, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	// one hardware PCF lookup per light
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+	// layered, the geometry shader picks slot * 6 + face
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubemapArray, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glGenFramebuffers(1, &clearFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, clearFBO);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	std::cout << "SHADOWMANAGER:: " << slotCount << " shadow slots of " << resolution << "x" << resolution << ", "
+		<< slotCount * slotSize / (1024 * 1024) << " MB" << std::endl;
+}
+
+void ShadowManager::assign(const std::vector<PointLight> &_lights, float _lightCutoff, const glm::mat4 &_viewProjection, glm::vec3 _eye,
+	bool _sceneChanged)
+{
+	pending.clear();
+	lightCount = (unsigned int)_lights.size();
+	if (!supported)
+		return;
+
+	std::vector<RankedLight> ranked = rankLights(_lights, _lightCutoff, _viewProjection, _eye);
+	if (ranked.size() > slotCount)
+		ranked.resize(slotCount);
+
+	// lights that keep their slot first, so their maps survive, then the newcomers take what was freed
+	std::vector<int> lightSlot(_lights.size(), -1);
+	for (unsigned int i = 0; i < slotCount; i++)
+	{
+		Slot &slot = slots[i];
+		bool kept = false;
+		for (const RankedLight &entry : ranked)
+			kept = kept || (int)entry.light == slot.light;
+		if (!kept)
+		{
+			slot.light = -1;
+			slot.drawn = false;
+			continue;
+		}
+		lightSlot[slot.light] = i;
+	}
+	for (const RankedLight &entry : ranked)
+	{
+		unsigned int light = entry.light;
+		if (lightSlot[light] < 0)
+		{
+			unsigned int free = 0;
+			while (slots[free].light >= 0)
+				free++;
+			slots[free].light = light;
+			slots[free].drawn = false;
+			lightSlot[light] = free;
+		}
+
+		Slot &slot = slots[lightSlot[light]];
+		slot.impact = entry.impact;
+		if (!slot.drawn || _sceneChanged || slot.position != _lights[light].position || slot.range != entry.range)
+			slot.dirty = true;
+		slot.position = _lights[light].position;
+		slot.range = entry.range;
+	}
+
+	// never drawn slots before stale ones, then by impact
+	for (unsigned int i = 0; i < slotCount; i++)
+		if (slots[i].light >= 0 && slots[i].dirty)
+			pending.push_back(i);
+	std::sort(pending.begin(), pending.end(), [&](unsigned int _a, unsigned int _b) {
+		if (slots[_a].drawn != slots[_b].drawn)
+			return !slots[_a].drawn;
+		return slots[_a].impact > slots[_b].impact;
+	});
+	if (pending.size() > maxUpdatesPerFrame)
+		pending.resize(maxUpdatesPerFrame);
+}
+
+// screen impact: the angular size of the light's reach times its brightness, nothing for lights off screen
+std::vector<ShadowManager::RankedLight> ShadowManager::rankLights(const std::vector<PointLight> &_lights, float _lightCutoff,
+	const glm::mat4 &_viewProjection, glm::vec3 _eye)
+{
+	Frustum frustum(_viewProjection);
+	std::vector<RankedLight> ranked;
+	for (unsigned int i = 0; i < _lights.size(); i++)
+	{
+		const PointLight &light = _lights[i];
+		float range = light.getRadius(_lightCutoff);
+		if (range <= 0.0f || !frustum.intersectsSphere(light.position, range))
+			continue;
+		float distance = std::max(glm::length(light.position - _eye), range * 0.5f);
+		float brightness = std::max(std::max(light.diffuse.r, light.diffuse.g), light.diffuse.b);
+		ranked.push_back({ i, range, range / distance, range / distance * brightness });
+	}
+	std::sort(ranked.begin(), ranked.end(), [](const RankedLight &_a, const RankedLight &_b) {
+		return _a.impact > _b.impact;
+	});
+	return ranked;
+}
+
+void ShadowManager::bindSlot(unsigned int _slot, Shader &_shader)
+{
+	Slot &slot = slots[_slot];
+	float nearPlane = std::max(0.05f, slot.range * 0.01f);
+	slot.matrices = ShadowFBO::cubeFaceMatrices(slot.position, nearPlane, slot.range);
+
+	glViewport(0, 0, resolution, resolution);
+	glBindFramebuffer(GL_FRAMEBUFFER, clearFBO);
+	for (unsigned int i = 0; i < 6; i++)
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubemapArray, 0, _slot * 6 + i);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+
+	for (unsigned int i = 0; i < 6; i++)
+		_shader.setMat4("shadowMatrices[" + std::to_string(i) + "]", slot.matrices[i]);
+	_shader.setInt("layerBase", _slot * 6);
+	_shader.setInt("skipFaces", 0);
+	_shader.setVec3("lightPos", slot.position);
+	_shader.setFloat("far_plane", slot.range);
+
+	slot.drawn = true;
+	slot.dirty = false;
+}
+
+const std::vector<glm::vec4> &ShadowManager::getShadowData()
+{
+	shadowData.assign(lightCount * LightClusters::shadowTexels, glm::vec4(0.0f));
+	for (unsigned int i = 0; i < lightCount; i++)
+		shadowData[i * LightClusters::shadowTexels] = glm::vec4(-1.0f, 1.0f, 0.0f, 0.0f);
+	for (unsigned int i = 0; i < slotCount; i++)
+		if (slots[i].light >= 0 && slots[i].drawn && (unsigned int)slots[i].light < lightCount)
+			shadowData[slots[i].light * LightClusters::shadowTexels] = glm::vec4((float)i, slots[i].range, 0.0f, 0.0f);
+	return shadowData;
+}
+
+void ShadowManager::bindTexture()
+{
+	if (!supported)
+		return;
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubemapArray);
+	glActiveTexture(GL_TEXTURE0);
+}
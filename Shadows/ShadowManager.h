@@ -0,0 +1,87 @@
+#ifndef _SHADOWMANAGER_H_
+#define _SHADOWMANAGER_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "PointLight.h"
+
+#include <vector>
+
+// Shadows for the clustered point lights. A cube map array holds a fixed number of slots, six layers each, and
+// every frame the lights are ranked by how much of the screen they light. The best ones get a slot, the rest
+// are shaded without shadows. Slots stay with their light while it keeps ranking high, so a map is only redrawn
+// when its light moves, the scene changes or the slot was just handed out, and no more than a few are redrawn
+// per frame. A freshly assigned slot reads as unshadowed until it has been drawn.
+// Needs GL 4.0 for cube map arrays, without it every clustered light stays unshadowed.
+class ShadowManager {
+public:
+	// texture unit the array is sampled from, compared and filtered by the texture's own sampler state
+	static const unsigned int textureUnit = 7;
+	static const unsigned int resolution = 256;
+	static const GLenum depthFormat = GL_DEPTH_COMPONENT24;
+
+	// slots wanted, cut down to what fits the memory budget
+	unsigned int maxSlots = 8;
+	size_t memoryBudget = 16 * 1024 * 1024;
+	// cube maps drawn per frame at most, the time budget
+	unsigned int maxUpdatesPerFrame = 2;
+
+	// a light on screen, as the shadow allocators see it
+	struct RankedLight {
+		unsigned int light;
+		float range;
+		float angularSize;	// range over the distance to the eye
+		float impact;		// angular size times brightness
+	};
+	// the lights on screen, the most screen impact first
+	static std::vector<RankedLight> rankLights(const std::vector<PointLight> &_lights, float _lightCutoff, const glm::mat4 &_viewProjection,
+		glm::vec3 _eye);
+
+	void configure();
+	bool isSupported() const { return supported; }
+
+	// ranks the lights and hands out the slots. _sceneChanged redraws every slot, something may have moved into
+	// their shadows
+	void assign(const std::vector<PointLight> &_lights, float _lightCutoff, const glm::mat4 &_viewProjection, glm::vec3 _eye,
+		bool _sceneChanged);
+
+	// slots to draw this frame, most important first
+	const std::vector<unsigned int> &getPendingSlots() const { return pending; }
+	// binds the slot's layers cleared and sets up the depth shader, the casters can be drawn after it
+	void bindSlot(unsigned int _slot, Shader &_shader);
+	glm::vec3 getSlotPosition(unsigned int _slot) const { return slots[_slot].position; }
+	float getSlotRange(unsigned int _slot) const { return slots[_slot].range; }
+	const std::vector<glm::mat4> &getSlotMatrices(unsigned int _slot) const { return slots[_slot].matrices; }
+
+	// per light: (slot or -1, far plane, 0, 0) and three zero texels, the light clusters' shadow texels
+	const std::vector<glm::vec4> &getShadowData();
+
+	void bindTexture();
+
+private:
+	struct Slot {
+		int light = -1;
+		glm::vec3 position = glm::vec3(0.0f);
+		float range = 0.0f;
+		float impact = 0.0f;
+		bool drawn = false;		// holds a map of this light, maybe from before it last moved
+		bool dirty = true;
+		std::vector<glm::mat4> matrices;
+	};
+
+	bool supported = false;
+	unsigned int slotCount = 0;
+	unsigned int cubemapArray;
+	unsigned int FBO;
+	unsigned int clearFBO;		// one layer at a time, clearing the layered FBO would wipe every slot
+
+	std::vector<Slot> slots;
+	std::vector<unsigned int> pending;
+	std::vector<glm::vec4> shadowData;
+	unsigned int lightCount = 0;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "ShadowMoments.h"
+
+#include <iostream>
+
+void ShadowMoments::configure()
+{
+	momentsCubemap = createCubemap(true);
+	blurCubemap = createCubemap(false);
+
+	glGenFramebuffers(1, &FBO);
+	glGenVertexArrays(1, &VAO);
+
+	blurShader.reset(new Shader("Shaders/shadowMoments.vert", "Shaders/shadowMomentsBlur.frag"));
+	blurShader->use();
+	blurShader->setInt("source", sourceUnit);
+	glUseProgram(0);
+
+	std::cout << "SHADOWMOMENTS:: " << resolution << "x" << resolution << " moments cubemap, "
+		<< 2 * 6 * resolution * resolution * 8 / (1024 * 1024) << " MB with the blur target" << std::endl;
+}
+
+void ShadowMoments::update(unsigned int _depthCubemap, unsigned int _version)
+{
+	if (hasMoments && _depthCubemap == depthCubemap && _version == version)
+		return;
+	depthCubemap = _depthCubemap;
+	version = _version;
+	hasMoments = true;
+
+	GLint previousViewport[4];
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+	glViewport(0, 0, resolution, resolution);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glDisable(GL_DEPTH_TEST);
+	glBindVertexArray(VAO);
+	blurShader->use();
+	blurShader->setInt("radius", blurRadius);
+	blurShader->setFloat("texelSize", 2.0f / resolution);
+
+	blur(depthCubemap, blurCubemap, true, false);
+	blur(blurCubemap, momentsCubemap, false, true);
+
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, momentsCubemap);
+	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void ShadowMoments::bindTexture()
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, momentsCubemap);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+// two 32 bit float channels, 16 bit floats lose the squared depth
+unsigned int ShadowMoments::createCubemap(bool _mipmapped)
+{
+	unsigned int levels = 1;
+	if (_mipmapped)
+		while ((resolution >> levels) > 0)
+			levels++;
+
+	unsigned int cubemap;
+	glGenTextures(1, &cubemap);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+	for (unsigned int level = 0; level < levels; level++)
+		for (unsigned int i = 0; i < 6; i++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RG32F, resolution >> level, resolution >> level, 0, GL_RG, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, _mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, _mipmapped ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	return cubemap;
+}
+
+// one fullscreen triangle per face of _destination
+void ShadowMoments::blur(unsigned int _source, unsigned int _destination, bool _fromDepth, bool _vertical)
+{
+	glActiveTexture(GL_TEXTURE0 + sourceUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, _source);
+	glActiveTexture(GL_TEXTURE0);
+
+	blurShader->setBool("fromDepth", _fromDepth);
+	blurShader->setBool("vertical", _vertical);
+	for (unsigned int i = 0; i < 6; i++)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, _destination, 0);
+		blurShader->setInt("face", i);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+}
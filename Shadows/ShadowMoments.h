@@ -0,0 +1,44 @@
+#ifndef _SHADOWMOMENTS_H_
+#define _SHADOWMOMENTS_H_
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+
+#include <memory>
+
+// Variance shadow map for the point light. The depth cubemap (distance / far plane) is turned into a cubemap of
+// the first two depth moments and prefiltered with a separable gaussian. Both blur passes look their taps up by
+// direction in a cubemap, so the kernel carries on into the neighbouring face instead of stopping at the seam.
+// Mipmaps are built afterwards, the lighting shader then gets a soft shadow from one trilinear fetch.
+class ShadowMoments {
+public:
+	// unit the moments are sampled from, and the one the blur reads its source through
+	static const unsigned int textureUnit = 9;
+	static const unsigned int sourceUnit = 8;
+	// prefiltered, so it doesn't need the depth map's resolution
+	static const unsigned int resolution = 512;
+	int blurRadius = 3;
+
+	void configure();
+
+	// rebuilds the moments from _depthCubemap, skipped while _version says the depth map hasn't changed
+	void update(unsigned int _depthCubemap, unsigned int _version);
+	void bindTexture();
+
+private:
+	unsigned int momentsCubemap;
+	unsigned int blurCubemap;		// horizontal pass result, the vertical pass reads it back
+	unsigned int FBO;
+	unsigned int VAO;				// empty, the fullscreen triangle comes from gl_VertexID
+	std::unique_ptr<Shader> blurShader;
+
+	bool hasMoments = false;
+	unsigned int depthCubemap = 0;
+	unsigned int version = 0;
+
+	unsigned int createCubemap(bool _mipmapped);
+	void blur(unsigned int _source, unsigned int _destination, bool _fromDepth, bool _vertical);
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "SoftwareOcclusion.h"
+
+#include <emmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+
+void SoftwareOcclusion::addTriangles(const std::vector<glm::vec3> &_positions)
+{
+	occluders.insert(occluders.end(), _positions.begin(), _positions.end() - _positions.size() % 3);
+}
+
+void SoftwareOcclusion::addMesh(const Mesh &_mesh, const glm::mat4 &_model)
+{
+	unsigned int first = 0, last = (unsigned int)_mesh.indices.size();
+	if (!_mesh.lods.empty())
+	{
+		const MeshLod &lod = _mesh.lods.front();
+		const Meshlet &firstMeshlet = _mesh.meshlets[lod.firstMeshlet];
+		const Meshlet &lastMeshlet = _mesh.meshlets[lod.firstMeshlet + lod.meshletCount - 1];
+		first = firstMeshlet.firstIndex;
+		last = lastMeshlet.firstIndex + lastMeshlet.indexCount;
+	}
+	for (unsigned int i = first; i < last; i++)
+		occluders.push_back(glm::vec3(_model * glm::vec4(_mesh.vertices[_mesh.indices[i]].Position, 1.0f)));
+}
+
+void SoftwareOcclusion::render(const glm::mat4 &_viewProjection, CommandRecorder &_workers)
+{
+	viewProjection = _viewProjection;
+	depth.assign(width * height, 1.0f);
+
+	triangles.clear();
+	for (size_t i = 0; i + 2 < occluders.size(); i += 3)
+	{
+		glm::vec4 clip[3];
+		for (unsigned int j = 0; j < 3; j++)
+			clip[j] = _viewProjection * glm::vec4(occluders[i + j], 1.0f);
+		clipAndSetup(clip);
+	}
+
+	// bands of rows never share a pixel, so the threads need no synchronisation
+	unsigned int bandCount = std::min(height, _workers.getWorkerCount() + 1);
+	_workers.run(bandCount, [&](unsigned int _band) {
+		rasterizeRows(_band * height / bandCount, (_band + 1) * height / bandCount);
+	});
+
+	rendered = true;
+}
+
+bool SoftwareOcclusion::isVisible(glm::vec3 _boxMin, glm::vec3 _boxMax) const
+{
+	if (!rendered)
+		return true;
+
+	// screen rectangle and nearest depth of the box's corners
+	float minX = (float)width, minY = (float)height, maxX = 0.0f, maxY = 0.0f, nearest = 1.0f;
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) ? _boxMax.x : _boxMin.x, (i & 2) ? _boxMax.y : _boxMin.y, (i & 4) ? _boxMax.z : _boxMin.z);
+		glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+		// crossing the near plane, the projection can't be trusted
+		if (clip.z < -clip.w || clip.w <= 0.0f)
+			return true;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		float x = (ndc.x * 0.5f + 0.5f) * width, y = (ndc.y * 0.5f + 0.5f) * height;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+		return false;
+
+	int x0 = std::max(0, (int)std::floor(minX)), x1 = std::min((int)width - 1, (int)std::floor(maxX));
+	int y0 = std::max(0, (int)std::floor(minY)), y1 = std::min((int)height - 1, (int)std::floor(maxY));
+
+	// visible as soon as one pixel's occluder is further away than the box, the tolerance keeps an occluder
+	// from hiding its own box when it faces the camera head on
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	__m128 boxDepth = _mm_set1_ps(nearest - depthTolerance);
+	__m128 first = _mm_set1_ps((float)x0), last = _mm_set1_ps((float)x1);
+	for (int y = y0; y <= y1; y++)
+	{
+		const float *row = &depth[y * width];
+		for (int x = x0 & ~3; x <= x1; x += 4)
+		{
+			__m128 pixel = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(pixel, first), _mm_cmple_ps(pixel, last));
+			__m128 behind = _mm_cmpgt_ps(_mm_loadu_ps(row + x), boxDepth);
+			if (_mm_movemask_ps(_mm_and_ps(inside, behind)) != 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+// cuts the triangle at the near plane (z >= -w), leaving up to two triangles
+void SoftwareOcclusion::clipAndSetup(const glm::vec4 *_clip)
+{
+	glm::vec4 polygon[4];
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		const glm::vec4 &a = _clip[i], &b = _clip[(i + 1) % 3];
+		float distanceA = a.z + a.w, distanceB = b.z + b.w;
+		if (distanceA >= 0.0f)
+			polygon[count++] = a;
+		if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+			polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+	}
+	if (count < 3)
+		return;
+
+	glm::vec3 screen[4];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		glm::vec3 ndc = glm::vec3(polygon[i]) / polygon[i].w;
+		screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+	}
+	setupTriangle(screen[0], screen[1], screen[2]);
+	if (count == 4)
+		setupTriangle(screen[0], screen[2], screen[3]);
+}
+
+void SoftwareOcclusion::setupTriangle(glm::vec3 _v0, glm::vec3 _v1, glm::vec3 _v2)
+{
+	float area = (_v1.x - _v0.x) * (_v2.y - _v0.y) - (_v2.x - _v0.x) * (_v1.y - _v0.y);
+	if (std::abs(area) < 1.0e-6f)
+		return;
+
+	ScreenTriangle triangle;
+	triangle.minX = std::max(0, (int)std::floor(std::min(_v0.x, std::min(_v1.x, _v2.x))));
+	triangle.minY = std::max(0, (int)std::floor(std::min(_v0.y, std::min(_v1.y, _v2.y))));
+	triangle.maxX = std::min((int)width - 1, (int)std::ceil(std::max(_v0.x, std::max(_v1.x, _v2.x))));
+	triangle.maxY = std::min((int)height - 1, (int)std::ceil(std::max(_v0.y, std::max(_v1.y, _v2.y))));
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+		return;
+
+	// both windings are drawn, the sign flips the edges so inside is positive either way
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	const glm::vec3 *vertices[3] = { &_v0, &_v1, &_v2 };
+	for (unsigned int i = 0; i < 3; i++)
+	{
+		const glm::vec3 &a = *vertices[i], &b = *vertices[(i + 1) % 3];
+		triangle.edgeA[i] = sign * (a.y - b.y);
+		triangle.edgeB[i] = sign * (b.x - a.x);
+		triangle.edgeC[i] = sign * (a.x * b.y - a.y * b.x);
+	}
+
+	triangle.depthDx = ((_v1.z - _v0.z) * (_v2.y - _v0.y) - (_v2.z - _v0.z) * (_v1.y - _v0.y)) / area;
+	triangle.depthDy = ((_v2.z - _v0.z) * (_v1.x - _v0.x) - (_v1.z - _v0.z) * (_v2.x - _v0.x)) / area;
+	// pixels keep the furthest depth the triangle has inside them, not the one at the centre
+	float pixelSlope = 0.5f * (std::abs(triangle.depthDx) + std::abs(triangle.depthDy));
+	triangle.depthAtOrigin = _v0.z - triangle.depthDx * _v0.x - triangle.depthDy * _v0.y + pixelSlope;
+	triangle.maxDepth = std::max(_v0.z, std::max(_v1.z, _v2.z));
+	triangles.push_back(triangle);
+}
+
+void SoftwareOcclusion::rasterizeRows(unsigned int _firstRow, unsigned int _lastRow)
+{
+	const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+	for (const ScreenTriangle &triangle : triangles)
+	{
+		int firstRow = std::max(triangle.minY, (int)_firstRow);
+		int lastRow = std::min(triangle.maxY, (int)_lastRow - 1);
+		if (firstRow > lastRow)
+			continue;
+
+		int firstX = triangle.minX & ~3;
+		__m128 stepX = _mm_set1_ps(4.0f);
+		__m128 a0 = _mm_set1_ps(triangle.edgeA[0]), a1 = _mm_set1_ps(triangle.edgeA[1]), a2 = _mm_set1_ps(triangle.edgeA[2]);
+		__m128 depthDx = _mm_set1_ps(triangle.depthDx);
+		__m128 maxDepth = _mm_set1_ps(triangle.maxDepth);
+		for (int y = firstRow; y <= lastRow; y++)
+		{
+			float centerY = y + 0.5f;
+			__m128 x = _mm_add_ps(_mm_set1_ps((float)firstX), lanes);
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, x), _mm_set1_ps(triangle.edgeB[0] * centerY + triangle.edgeC[0]));
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, x), _mm_set1_ps(triangle.edgeB[1] * centerY + triangle.edgeC[1]));
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, x), _mm_set1_ps(triangle.edgeB[2] * centerY + triangle.edgeC[2]));
+			__m128 z = _mm_add_ps(_mm_mul_ps(depthDx, x), _mm_set1_ps(triangle.depthAtOrigin + triangle.depthDy * centerY));
+			__m128 stepE0 = _mm_mul_ps(a0, stepX), stepE1 = _mm_mul_ps(a1, stepX), stepE2 = _mm_mul_ps(a2, stepX);
+			__m128 stepZ = _mm_mul_ps(depthDx, stepX);
+
+			float *row = &depth[y * width];
+			for (int px = firstX; px <= triangle.maxX; px += 4)
+			{
+				__m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(covered) != 0)
+				{
+					__m128 old = _mm_loadu_ps(row + px);
+					__m128 nearer = _mm_min_ps(old, _mm_min_ps(z, maxDepth));
+					_mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(covered, nearer), _mm_andnot_ps(covered, old)));
+				}
+				e0 = _mm_add_ps(e0, stepE0);
+				e1 = _mm_add_ps(e1, stepE1);
+				e2 = _mm_add_ps(e2, stepE2);
+				z = _mm_add_ps(z, stepZ);
+			}
+		}
+	}
+}
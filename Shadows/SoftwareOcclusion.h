@@ -0,0 +1,58 @@
+#ifndef _SOFTWAREOCCLUSION_H_
+#define _SOFTWAREOCCLUSION_H_
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "CommandRecorder.h"
+
+#include <vector>
+
+// CPU occlusion culling: a handful of static occluders (room walls, big furniture at full resolution) are
+// rasterised into a small depth buffer with SSE, four pixels per instruction, and split into bands of rows
+// that are drawn on the command recorder's worker threads. Object boxes are then tested against it before anything goes to GL.
+// The occluders are drawn at pixel centres, so an object showing through less than one of these pixels can
+// be culled.
+class SoftwareOcclusion {
+public:
+	static const unsigned int width = 320;
+	static const unsigned int height = 180;
+	static constexpr float depthTolerance = 1.0e-5f;
+
+	// world space triangle list, three positions per triangle
+	void addTriangles(const std::vector<glm::vec3> &_positions);
+	// the mesh's full resolution level moved into world space. Not a coarser LOD, the simplifier may move the
+	// surface outwards, and a grown occluder hides objects the real one leaves in view
+	void addMesh(const Mesh &_mesh, const glm::mat4 &_model);
+
+	// clears the depth buffer and draws the occluders as seen through _viewProjection, one band of rows per
+	// thread of _workers
+	void render(const glm::mat4 &_viewProjection, CommandRecorder &_workers);
+	// true unless the whole world space box is behind the occluders of the last render
+	bool isVisible(glm::vec3 _boxMin, glm::vec3 _boxMax) const;
+
+	bool isEnabled() const { return enabled; }
+	void setEnabled(bool _enabled) { enabled = _enabled; }
+	size_t getTriangleCount() const { return occluders.size() / 3; }
+
+private:
+	// edge functions are positive inside, depth is a plane over the screen
+	struct ScreenTriangle {
+		int minX, minY, maxX, maxY;
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthAtOrigin, depthDx, depthDy, maxDepth;
+	};
+
+	bool enabled = true;
+	bool rendered = false;
+	std::vector<glm::vec3> occluders;
+	std::vector<ScreenTriangle> triangles;
+	std::vector<float> depth;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+
+	void clipAndSetup(const glm::vec4 *_clip);
+	void setupTriangle(glm::vec3 _v0, glm::vec3 _v1, glm::vec3 _v2);
+	void rasterizeRows(unsigned int _firstRow, unsigned int _lastRow);
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "StaticBatch.h"
+#include "MeshOptimizer.h"
+
+#include <iostream>
+
+void StaticBatch::addMeshes(const std::vector<Mesh> &_meshes, const glm::mat4 &_model)
+{
+	for (const Mesh &mesh : _meshes)
+	{
+		Batch &batch = findBatch(mesh.textures, mesh.diffuseColor, mesh.shadowOnly, false);
+		unsigned int base = (unsigned int)batch.vertices.size();
+		addVertices(batch, mesh.vertices, _model);
+
+		// the full resolution level is the first one in the index buffer
+		size_t indexCount = mesh.indices.size();
+		if (mesh.lods.size() > 1)
+			indexCount = mesh.meshlets[mesh.lods[1].firstMeshlet].firstIndex;
+		for (size_t i = 0; i < indexCount; i++)
+			batch.indices.push_back(mesh.indices[i] + base);
+	}
+}
+
+void StaticBatch::addTriangles(const std::vector<Vertex> &_vertices, const std::vector<Texture> &_textures, const glm::mat4 &_model,
+	bool _enclosing)
+{
+	Batch &batch = findBatch(_textures, glm::vec3(1.0f), false, _enclosing);
+	unsigned int base = (unsigned int)batch.vertices.size();
+	addVertices(batch, _vertices, _model);
+	for (unsigned int i = 0; i < _vertices.size(); i++)
+		batch.indices.push_back(base + i);
+}
+
+void StaticBatch::build()
+{
+	size_t vertexCount = 0, triangleCount = 0;
+	for (Batch &batch : pending)
+	{
+		if (batch.indices.empty())
+			continue;
+
+		weldVertices(batch.vertices, batch.indices);
+		optimizeVertexCache(batch.indices, batch.vertices.size());
+		optimizeVertexFetch(batch.vertices, batch.indices);
+
+		meshes.push_back(Mesh(batch.vertices, batch.indices, batch.textures));
+		Mesh &mesh = meshes.back();
+		mesh.meshlets = buildMeshlets(batch.vertices, batch.indices);
+		mesh.lods.push_back({ 0, (unsigned int)mesh.meshlets.size(), 0.0f });
+		mesh.diffuseColor = batch.diffuseColor;
+		mesh.shadowOnly = batch.shadowOnly;
+		enclosing.push_back(batch.enclosing);
+
+		vertexCount += batch.vertices.size();
+		triangleCount += batch.indices.size() / 3;
+	}
+	pending.clear();
+
+	std::cout << "STATICBATCH:: " << meshes.size() << " batches, " << vertexCount << " vertices, " << triangleCount << " triangles" << std::endl;
+}
+
+void StaticBatch::record(CommandBuffer &_commands, const Shader &_shader, bool _withTextures, const CullView &_view,
+	const std::vector<unsigned int> *_visibleMeshes, bool _withEnclosing)
+{
+	// already in world space, the meshlet bounds are all the culling needs
+	LocalCullView localView(_view, glm::mat4(1.0f), glm::vec3(0.0f), 0.0f);
+	localView.boundsTested = _visibleMeshes != nullptr;
+	unsigned int count = _visibleMeshes ? (unsigned int)_visibleMeshes->size() : (unsigned int)meshes.size();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned int index = _visibleMeshes ? (*_visibleMeshes)[i] : i;
+		if (enclosing[index] && !_withEnclosing)
+			continue;
+		Mesh &mesh = meshes[index];
+		if (_withTextures)
+			mesh.Record(_commands, _shader, true, localView);
+		else
+			mesh.RecordDepth(_commands, _shader, localView);
+	}
+}
+
+std::vector<std::string> StaticBatch::getSamplerNames() const
+{
+	std::vector<std::string> names;
+	for (const Mesh &mesh : meshes)
+		names.insert(names.end(), mesh.samplerNames.begin(), mesh.samplerNames.end());
+	return names;
+}
+
+StaticBatch::Batch &StaticBatch::findBatch(const std::vector<Texture> &_textures, glm::vec3 _diffuseColor, bool _shadowOnly,
+	bool _enclosing)
+{
+	// same textures in the same order is the same material, untextured ones are told apart by their colour
+	for (Batch &batch : pending)
+	{
+		if (batch.shadowOnly != _shadowOnly || batch.enclosing != _enclosing || batch.textures.size() != _textures.size())
+			continue;
+		if (_textures.empty() && batch.diffuseColor != _diffuseColor)
+			continue;
+		bool same = true;
+		for (unsigned int i = 0; i < _textures.size() && same; i++)
+			same = batch.textures[i].id == _textures[i].id;
+		if (same)
+			return batch;
+	}
+
+	pending.push_back(Batch());
+	pending.back().textures = _textures;
+	pending.back().diffuseColor = _diffuseColor;
+	pending.back().shadowOnly = _shadowOnly;
+	pending.back().enclosing = _enclosing;
+	return pending.back();
+}
+
+void StaticBatch::addVertices(Batch &_batch, const std::vector<Vertex> &_vertices, const glm::mat4 &_model)
+{
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(_model)));
+	for (const Vertex &vertex : _vertices)
+	{
+		Vertex world = vertex;
+		world.Position = glm::vec3(_model * glm::vec4(vertex.Position, 1.0f));
+		world.Normal = normalMatrix * vertex.Normal;
+		world.Tangent = glm::mat3(_model) * vertex.Tangent;
+		world.Bitangent = glm::mat3(_model) * vertex.Bitangent;
+		_batch.vertices.push_back(world);
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef _STATICBATCH_H_
+#define _STATICBATCH_H_
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "CommandBuffer.h"
+#include "Culling.h"
+#include "Shader.h"
+
+#include <string>
+#include <vector>
+
+// Geometry of everything flagged static, baked into world space at load and grouped by material. The whole
+// static world then draws with an identity model matrix in one draw per material.
+class StaticBatch {
+public:
+	// adds the full resolution level of each mesh, transformed by _model
+	void addMeshes(const std::vector<Mesh> &_meshes, const glm::mat4 &_model);
+	// adds a non indexed triangle list. _enclosing marks the inside of the room, which surrounds every light and
+	// so can't shadow itself, see record
+	void addTriangles(const std::vector<Vertex> &_vertices, const std::vector<Texture> &_textures, const glm::mat4 &_model,
+		bool _enclosing = false);
+	// optimises and uploads the batches, call once after everything static was added
+	void build();
+
+	// records the batches, the model matrix has to be identity. _visibleMeshes limits it to batches a BVH query
+	// found in view, nullptr tests them all. Without _withEnclosing the room's batches are left out.
+	void record(CommandBuffer &_commands, const Shader &_shader, bool _withTextures, const CullView &_view,
+		const std::vector<unsigned int> *_visibleMeshes = nullptr, bool _withEnclosing = true);
+
+	const std::vector<Mesh> &getMeshes() const { return meshes; }
+
+	std::vector<std::string> getSamplerNames() const;
+	size_t getBatchCount() const { return meshes.size(); }
+
+private:
+	struct Batch {
+		std::vector<Texture> textures;
+		glm::vec3 diffuseColor;
+		bool shadowOnly;
+		bool enclosing;
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+	};
+
+	std::vector<Batch> pending;
+	std::vector<Mesh> meshes;
+	std::vector<bool> enclosing;	// per mesh
+
+	Batch &findBatch(const std::vector<Texture> &_textures, glm::vec3 _diffuseColor, bool _shadowOnly, bool _enclosing);
+	void addVertices(Batch &_batch, const std::vector<Vertex> &_vertices, const glm::mat4 &_model);
+};
+
+#endif
@@ -8,13 +8,19 @@
 
 class Transform {
 public:
-	void setPos(glm::vec3 _position){position = _position;}
-	void setScale(glm::vec3 _scale) { scale = _scale; }
-	void setRotation(glm::vec3 _rotation) { rotation = _rotation; }
+	void setPos(glm::vec3 _position){position = _position; dirty = true;}
+	void setScale(glm::vec3 _scale) { scale = _scale; dirty = true; }
+	void setRotation(glm::vec3 _rotation) { rotation = _rotation; dirty = true; }
+	// static objects never move after loading and get baked into the static batch
+	void setStatic(bool _isStatic) { isStatic = _isStatic; }
 
 	glm::vec3 getPos() { return position; }
 	glm::vec3 getScale() { return scale; }
 	glm::vec3 getRotation() { return rotation; }
+	bool getStatic() { return isStatic; }
+	// set whenever the transform changes, whoever caches world space bounds clears it
+	bool isDirty() { return dirty; }
+	void clearDirty() { dirty = false; }
 
 	glm::mat4 getModel() {
 		glm::mat4 model = glm::mat4(1.0f);
@@ -30,6 +36,8 @@ protected:
 	glm::vec3 position = glm::vec3(0.0f);
 	glm::vec3 scale = glm::vec3(1.0f);
 	glm::vec3 rotation;
+	bool isStatic = false;
+	bool dirty = true;
 };
 
 #endif
\ No newline at end of file
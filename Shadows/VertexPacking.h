@@ -0,0 +1,91 @@
+#ifndef _VERTEXPACKING_H_
+#define _VERTEXPACKING_H_
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstddef>
+
+// Compressed vertex layout used on the GPU, 20 bytes instead of the 56 of a full float Vertex.
+// The vertex shaders undo the packing (see pointLShadows.vert).
+struct PackedVertex {
+	unsigned short Position[4];		// xyz normalised to the mesh bounds, w holds the bitangent sign (0 = -1, 65535 = +1)
+	short Normal[2];				// octahedral encoded, snorm
+	unsigned short TexCoords[2];	// half floats
+	short Tangent[2];				// octahedral encoded, snorm
+};
+
+// maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2
+inline glm::vec2 octEncode(glm::vec3 _n)
+{
+	_n /= (std::abs(_n.x) + std::abs(_n.y) + std::abs(_n.z));
+	glm::vec2 encoded(_n.x, _n.y);
+	if (_n.z < 0.0f)
+	{
+		encoded.x = (1.0f - std::abs(_n.y)) * (_n.x >= 0.0f ? 1.0f : -1.0f);
+		encoded.y = (1.0f - std::abs(_n.x)) * (_n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+// any unit vector perpendicular to _n, for vertices without a usable tangent
+inline glm::vec3 perpendicular(glm::vec3 _n)
+{
+	glm::vec3 axis = std::abs(_n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	return glm::normalize(glm::cross(_n, axis));
+}
+
+// _boundsMin/_boundsScale describe the box positions are normalised to, the shader gets the same values
+inline PackedVertex packVertex(glm::vec3 _position, glm::vec3 _normal, glm::vec2 _texCoords, glm::vec3 _tangent, glm::vec3 _bitangent,
+	glm::vec3 _boundsMin, glm::vec3 _boundsScale)
+{
+	PackedVertex packed;
+
+	glm::vec3 normalised = glm::clamp((_position - _boundsMin) / _boundsScale, 0.0f, 1.0f);
+	for (int i = 0; i < 3; i++)
+		packed.Position[i] = glm::packUnorm1x16(normalised[i]);
+
+	float length = glm::length(_normal);
+	glm::vec3 normal = length > 0.0f ? _normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+	// Gram-Schmidt the tangent against the normal, the bitangent is rebuilt from the cross product and a sign
+	glm::vec3 tangent = _tangent - normal * glm::dot(normal, _tangent);
+	length = glm::length(tangent);
+	tangent = length > 1.0e-6f ? tangent / length : perpendicular(normal);
+	packed.Position[3] = glm::dot(glm::cross(normal, tangent), _bitangent) < 0.0f ? 0 : 65535;
+
+	glm::vec2 encoded = octEncode(normal);
+	packed.Normal[0] = (short)glm::packSnorm1x16(encoded.x);
+	packed.Normal[1] = (short)glm::packSnorm1x16(encoded.y);
+
+	encoded = octEncode(tangent);
+	packed.Tangent[0] = (short)glm::packSnorm1x16(encoded.x);
+	packed.Tangent[1] = (short)glm::packSnorm1x16(encoded.y);
+
+	packed.TexCoords[0] = glm::packHalf1x16(_texCoords.x);
+	packed.TexCoords[1] = glm::packHalf1x16(_texCoords.y);
+
+	return packed;
+}
+
+// sets up attributes 0-3 for a buffer of PackedVertex bound to GL_ARRAY_BUFFER
+inline void setPackedVertexAttributes()
+{
+	// position + bitangent sign
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+	// octahedral normal
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+	// texture coords
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+	// octahedral tangent
+	glEnableVertexAttribArray(3);
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+}
+
+#endif
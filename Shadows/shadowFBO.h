@@ -7,62 +7,283 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "Shader.h"
 
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// Depth cubemap of the shadow casting point light. Static casters are cached in a cubemap of their own that is
+// only redrawn once the light settles somewhere new, dynamic casters are drawn each frame over a copy of it.
+// While the light keeps moving the cache would be thrown away every frame, so everything goes straight into
+// the sampled map instead.
+// Resolution and depth format can change at runtime, the cubemaps are then reallocated.
 class ShadowFBO {
 public:	
-	const unsigned int resolution = 2048;
+	static const unsigned int minResolution = 256;
+	static const unsigned int maxResolution = 4096;
+	unsigned int resolution = 2048;
+	GLenum depthFormat = GL_DEPTH_COMPONENT24;
+	// texture unit the depth cubemap is sampled from, kept clear of the material textures
+	static const unsigned int textureUnit = 12;
+	// the same cubemap again through a comparison sampler, for samplerCubeShadow lookups
+	static const unsigned int compareTextureUnit = 10;
 	unsigned int FBO;
 	unsigned int depthCubemap;
 	std::vector<glm::mat4> shadowTransforms;
 
 
 	void configureFBO() {
-		glGenFramebuffers(1, &FBO);
+		FBO = createFramebuffer();
+		staticFBO = createFramebuffer();
+		// single face attachments for copying the cache without glCopyImageSubData
+		copyReadFBO = createFramebuffer();
+		copyDrawFBO = createFramebuffer();
+		allocate();
 
-		// create depth cubemap texture
-		glGenTextures(1, &depthCubemap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-		for (unsigned int i = 0; i < 6; ++i)
+		// sampler objects hold the filtering, so the raw depth and the compared depth can both be read from one
+		// texture. The comparison one filters linearly, each lookup is a bilinear PCF of four texels.
+		glGenSamplers(1, &depthSampler);
+		glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glGenSamplers(1, &compareSampler);
+		glSamplerParameteri(compareSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(compareSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(compareSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glSamplerParameteri(compareSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		for (unsigned int sampler : { depthSampler, compareSampler })
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		}
+	}
+
+	// _depthFormat is GL_DEPTH_COMPONENT16, 24 or 32F. Both cubemaps are recreated and the caches dropped
+	void setQuality(unsigned int _resolution, GLenum _depthFormat)
+	{
+		_resolution = std::min(maxResolution, std::max(minResolution, _resolution));
+		if (_resolution == resolution && _depthFormat == depthFormat)
+			return;
+		resolution = _resolution;
+		depthFormat = _depthFormat;
+		glDeleteTextures(1, &depthCubemap);
+		glDeleteTextures(1, &staticCubemap);
+		allocate();
+	}
+
+	// bytes of depth the cubemaps take, 24 bit depth is stored in 32 bits
+	size_t getMemoryUsage() const
+	{
+		size_t texelSize = depthFormat == GL_DEPTH_COMPONENT16 ? 2 : 4;
+		return 2 * 6 * (size_t)resolution * resolution * texelSize;
+	}
+
+	static const char *getFormatName(GLenum _depthFormat)
+	{
+		switch (_depthFormat)
+		{
+		case GL_DEPTH_COMPONENT16: return "16 bit";
+		case GL_DEPTH_COMPONENT24: return "24 bit";
+		case GL_DEPTH_COMPONENT32F: return "32 bit float";
+		default: return "unknown";
 		}
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		// attach depth texture as FBO's depth buffer
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
 	void createCubemapTransformationMatrices(glm::vec3 _lightPos,float _nearPlane, float _farPlane)
 	{
-		glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), (float)resolution / (float)resolution, _nearPlane, _farPlane);
+		shadowTransforms = cubeFaceMatrices(_lightPos, _nearPlane, _farPlane);
+	}
+
+	// projection * view of the six faces in GL cube map order, shared with the ShadowManager's slots
+	static std::vector<glm::mat4> cubeFaceMatrices(glm::vec3 _lightPos, float _nearPlane, float _farPlane)
+	{
+		glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, _nearPlane, _farPlane);
 
-		shadowTransforms.clear();
+		std::vector<glm::mat4> shadowTransforms;
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
 		shadowTransforms.push_back(shadowProj * glm::lookAt(_lightPos, _lightPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+		return shadowTransforms;
+	}
+
+	// remembers where the light is, true when it or its planes changed since the last frame. Both caches are
+	// stale then.
+	bool setLight(glm::vec3 _lightPos, float _nearPlane, float _farPlane)
+	{
+		glm::vec2 planes(_nearPlane, _farPlane);
+		if (_lightPos == lightPos && planes == lightPlanes)
+			return false;
+		lightPos = _lightPos;
+		lightPlanes = planes;
+		staticCached = false;
+		compositeCached = false;
+		return true;
+	}
+
+	bool isStaticCached() const { return staticCached; }
+	bool isCompositeCached() const { return compositeCached; }
+
+	// the map the lighting reads, and a count that goes up whenever what it holds changes
+	unsigned int getSampledCubemap() const { return sampledCubemap; }
+	unsigned int getVersion() const { return version; }
+
+	void bindTexture()
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sampledCubemap);
+		glBindSampler(textureUnit, depthSampler);
+		glActiveTexture(GL_TEXTURE0 + compareTextureUnit);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sampledCubemap);
+		glBindSampler(compareTextureUnit, compareSampler);
+		glActiveTexture(GL_TEXTURE0);
 	}
 
+	// every caster straight into the sampled map, for a moving light
 	void bindFBO(Shader _shader) 
 	{
+		bindCleared(FBO, _shader);
+		sampledCubemap = depthCubemap;
+		compositeCached = false;
+	}
+
+	// redraws the static cache
+	void bindStaticFBO(Shader _shader)
+	{
+		bindCleared(staticFBO, _shader);
+		staticCached = true;
+		compositeCached = false;
+	}
+
+	// no dynamic casters in reach, the cache is sampled as it is
+	void useStaticMap()
+	{
+		if (sampledCubemap != staticCubemap)
+			version++;
+		sampledCubemap = staticCubemap;
+		compositeCached = false;
+	}
+
+	// copies the cache into the sampled map and binds it, without clearing, for the dynamic casters
+	void bindCompositeFBO(Shader _shader)
+	{
+		if (GLAD_GL_VERSION_4_3)
+			glCopyImageSubData(staticCubemap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, depthCubemap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, resolution, resolution, 6);
+		else
+		{
+			for (unsigned int i = 0; i < 6; ++i)
+			{
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, copyReadFBO);
+				glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, staticCubemap, 0);
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyDrawFBO);
+				glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, depthCubemap, 0);
+				glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+			}
+		}
+
 		glViewport(0, 0, resolution, resolution);
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		setMatrices(_shader);
+		sampledCubemap = depthCubemap;
+		compositeCached = true;
+		version++;
+	}
+
+private:
+	unsigned int staticFBO;
+	unsigned int staticCubemap;
+	unsigned int copyReadFBO, copyDrawFBO;
+	unsigned int sampledCubemap;
+	unsigned int depthSampler, compareSampler;
+
+	glm::vec3 lightPos = glm::vec3(0.0f);
+	glm::vec2 lightPlanes = glm::vec2(0.0f);
+	bool staticCached = false;
+	bool compositeCached = false;
+	unsigned int version = 0;
+
+	void allocate()
+	{
+		depthCubemap = createCubemap();
+		attach(FBO, depthCubemap);
+		staticCubemap = createCubemap();
+		attach(staticFBO, staticCubemap);
+		sampledCubemap = depthCubemap;
+
+		// whatever was cached belongs to the old maps, the next setLight counts as a move
+		lightPlanes = glm::vec2(0.0f);
+		staticCached = false;
+		compositeCached = false;
+		version++;
+
+		std::cout << "SHADOWFBO:: " << resolution << "x" << resolution << " " << getFormatName(depthFormat) << " depth, "
+			<< getMemoryUsage() / (1024 * 1024) << " MB for the shadow and cache cubemaps" << std::endl;
+	}
+
+	// immutable storage where there is glTexStorage (4.2), sized formats either way
+	unsigned int createCubemap()
+	{
+		unsigned int cubemap;
+		glGenTextures(1, &cubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+		if (GLAD_GL_VERSION_4_2)
+			glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, depthFormat, resolution, resolution);
+		else
+		{
+			GLenum type = depthFormat == GL_DEPTH_COMPONENT32F ? GL_FLOAT : GL_UNSIGNED_INT;
+			for (unsigned int i = 0; i < 6; ++i)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, depthFormat, resolution, resolution, 0, GL_DEPTH_COMPONENT, type, NULL);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		return cubemap;
+	}
+
+	// depth only framebuffer, the cubemap is attached once it's allocated
+	unsigned int createFramebuffer()
+	{
+		unsigned int framebuffer;
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return framebuffer;
+	}
+
+	// attach depth texture as FBO's depth buffer
+	void attach(unsigned int _framebuffer, unsigned int _cubemap)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, _cubemap, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void bindCleared(unsigned int _framebuffer, Shader &_shader)
+	{
+		glViewport(0, 0, resolution, resolution);
+		glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
 		glClear(GL_DEPTH_BUFFER_BIT);
+		setMatrices(_shader);
+		version++;
+	}
 
+	void setMatrices(Shader &_shader)
+	{
 		for (unsigned int i = 0; i < 6; ++i)
 			_shader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
-
+		_shader.setInt("layerBase", 0);
+		_shader.setInt("skipFaces", 0);
 	}
-	
 };
 
 